@@ -0,0 +1,147 @@
+import * as net from "node:net";
+import { monitorEventLoopDelay } from "node:perf_hooks";
+import { buildRequestBody, encodeMessageSegment } from "../src/requestBody";
+import { buildResponseFrame } from "../src/serializer";
+
+// イベントループ遅延ベンチマーク
+// 巨大なレスポンス生成中に、接続受付とハートビートの遅延がどう変化するかを測定する
+//
+// 使い方: npm run bench:eventloop
+//   BENCH_PAYLOAD_KB   1レスポンスあたりのサイズ（既定: 4096）
+//   BENCH_CONCURRENCY  同時に生成するレスポンス数（既定: 4）
+//   BENCH_DURATION_MS  各モードの測定時間（既定: 5000）
+
+const PAYLOAD_KB = Number.parseInt(process.env.BENCH_PAYLOAD_KB || "4096", 10);
+const CONCURRENCY = Number.parseInt(process.env.BENCH_CONCURRENCY || "4", 10);
+const DURATION_MS = Number.parseInt(
+  process.env.BENCH_DURATION_MS || "5000",
+  10
+);
+const HEARTBEAT_INTERVAL_MS = 20;
+
+// コード混じりの長い回答を模したペイロード
+function makeContent(sizeKb: number): string {
+  const line =
+    'if (a < b && c > d) { console.log("こんにちは、世界"); } // <tag>\n';
+  return line.repeat(Math.ceil((sizeKb * 1024) / line.length));
+}
+
+// パーセンタイルを求める
+function percentile(values: number[], p: number): number {
+  if (values.length === 0) {
+    return 0;
+  }
+  const sorted = [...values].sort((a, b) => a - b);
+  const index = Math.min(
+    sorted.length - 1,
+    Math.floor((p / 100) * sorted.length)
+  );
+  return sorted[index];
+}
+
+interface Result {
+  mode: string;
+  frames: number;
+  loopP50: number;
+  loopP99: number;
+  loopMax: number;
+  acceptP50: number;
+  acceptP99: number;
+  acceptMax: number;
+}
+
+// 1モード分の測定
+async function runMode(mode: string, threshold: number): Promise<Result> {
+  const content = makeContent(PAYLOAD_KB);
+  // 会話履歴は変換済みのセグメントとして持つ（サーバーと同じ）
+  const segments = Array.from({ length: 10 }, (_, i) =>
+    encodeMessageSegment({
+      role: i % 2 === 0 ? "user" : "assistant",
+      content,
+    })
+  );
+
+  // 接続を受け付けるとすぐに1バイト返すサーバー
+  const server = net.createServer((socket) => {
+    socket.end("k");
+  });
+  await new Promise<void>((resolve) => server.listen(0, "127.0.0.1", resolve));
+  const port = (server.address() as net.AddressInfo).port;
+
+  const histogram = monitorEventLoopDelay({ resolution: 1 });
+  histogram.enable();
+
+  const acceptLatencies: number[] = [];
+  const deadline = Date.now() + DURATION_MS;
+  let frames = 0;
+
+  // ハートビート: 一定間隔で接続し、応答までの時間を測る
+  const heartbeat = setInterval(() => {
+    const start = process.hrtime.bigint();
+    const socket = net.connect(port, "127.0.0.1");
+    socket.once("data", () => {
+      acceptLatencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+      socket.destroy();
+    });
+    socket.on("error", () => socket.destroy());
+  }, HEARTBEAT_INTERVAL_MS);
+
+  // 負荷: レスポンス生成とリクエストボディの組み立てを繰り返す
+  // （ボディは新しいメッセージだけを変換して連結するため、常にメインスレッドで行う）
+  const workers = Array.from({ length: CONCURRENCY }, async () => {
+    while (Date.now() < deadline) {
+      await buildResponseFrame(
+        { response: { model: "bench", content } },
+        threshold
+      );
+      buildRequestBody({ model: "bench" }, [
+        ...segments,
+        encodeMessageSegment({ role: "user", content: "next" }),
+      ]);
+      frames++;
+      // 他のタスクに処理を譲る
+      await new Promise((resolve) => setImmediate(resolve));
+    }
+  });
+  await Promise.all(workers);
+
+  clearInterval(heartbeat);
+  histogram.disable();
+  await new Promise((resolve) => server.close(resolve));
+
+  return {
+    mode,
+    frames,
+    loopP50: histogram.percentile(50) / 1e6,
+    loopP99: histogram.percentile(99) / 1e6,
+    loopMax: histogram.max / 1e6,
+    acceptP50: percentile(acceptLatencies, 50),
+    acceptP99: percentile(acceptLatencies, 99),
+    acceptMax: percentile(acceptLatencies, 100),
+  };
+}
+
+async function main(): Promise<void> {
+  console.log(
+    `payload=${PAYLOAD_KB}KB concurrency=${CONCURRENCY} duration=${DURATION_MS}ms`
+  );
+  const results = [
+    await runMode("inline", Number.POSITIVE_INFINITY),
+    await runMode("worker", 0),
+  ];
+  console.table(
+    results.map((r) => ({
+      mode: r.mode,
+      frames: r.frames,
+      "loop p50 (ms)": r.loopP50.toFixed(2),
+      "loop p99 (ms)": r.loopP99.toFixed(2),
+      "loop max (ms)": r.loopMax.toFixed(2),
+      "accept p50 (ms)": r.acceptP50.toFixed(2),
+      "accept p99 (ms)": r.acceptP99.toFixed(2),
+      "accept max (ms)": r.acceptMax.toFixed(2),
+    }))
+  );
+  process.exit(0);
+}
+
+main();
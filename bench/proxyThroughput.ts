@@ -0,0 +1,190 @@
+import { type ChildProcess, fork } from "node:child_process";
+import * as net from "node:net";
+import * as path from "node:path";
+import { HashRing } from "../src/proxy";
+
+// プロキシのスループットベンチマーク
+// ローカルに複数のダミーバックエンドを起動し、ノード数ごとのスループットを測定する
+//
+// 使い方: npm run bench:proxy
+//   BENCH_NODES        測定するノード数（カンマ区切り、既定: 1,2,4）
+//   BENCH_CLIENTS      同時接続クライアント数（既定: 64）
+//   BENCH_WORK_MS      バックエンドが1リクエストあたりに消費するCPU時間（既定: 2）
+//   BENCH_DURATION_MS  各測定の時間（既定: 5000）
+
+const NODE_COUNTS = (process.env.BENCH_NODES || "1,2,4")
+  .split(",")
+  .map((value) => Number.parseInt(value, 10));
+const CLIENTS = Number.parseInt(process.env.BENCH_CLIENTS || "64", 10);
+const WORK_MS = Number.parseInt(process.env.BENCH_WORK_MS || "2", 10);
+const DURATION_MS = Number.parseInt(
+  process.env.BENCH_DURATION_MS || "5000",
+  10
+);
+const BASE_PORT = 4700;
+
+// ダミーバックエンド: 1行受け取るごとにCPU時間を消費してXMLフレームを返す
+function runBackend(port: number): void {
+  const frame = `<response>\n  <model>bench</model>\n  <content>${"x".repeat(
+    512
+  )}</content>\n</response>\n`;
+  net
+    .createServer((socket) => {
+      let buffer = "";
+      socket.setEncoding("utf-8");
+      socket.on("data", (chunk: string) => {
+        buffer += chunk;
+        const lines = buffer.split("\n");
+        buffer = lines.pop() || "";
+        for (const _line of lines) {
+          const until = Date.now() + WORK_MS;
+          while (Date.now() < until) {
+            // CPU時間を消費
+          }
+          socket.write(frame);
+        }
+      });
+      socket.on("error", () => socket.destroy());
+    })
+    .listen(port, "127.0.0.1", () => process.send?.("ready"));
+}
+
+// 子プロセスの起動を待つ
+function spawn(args: string[], env: NodeJS.ProcessEnv): Promise<ChildProcess> {
+  return new Promise((resolve) => {
+    const child = fork(args[0], args.slice(1), {
+      env: { ...process.env, ...env },
+      stdio: ["ignore", "ignore", "inherit", "ipc"],
+    });
+    child.once("message", () => resolve(child));
+  });
+}
+
+// プロキシの待ち受け開始を待つ
+async function waitForPort(port: number): Promise<void> {
+  for (;;) {
+    const ok = await new Promise<boolean>((resolve) => {
+      const socket = net.connect(port, "127.0.0.1");
+      socket.once("connect", () => {
+        socket.destroy();
+        resolve(true);
+      });
+      socket.once("error", () => resolve(false));
+    });
+    if (ok) {
+      return;
+    }
+    await new Promise((resolve) => setTimeout(resolve, 100));
+  }
+}
+
+// 1クライアント: セッションを張り、期限まで要求と応答を繰り返す
+function runClient(
+  port: number,
+  id: number,
+  deadline: number
+): Promise<number> {
+  return new Promise((resolve) => {
+    const socket = net.connect(port, "127.0.0.1");
+    let completed = 0;
+    let buffer = "";
+    socket.setEncoding("utf-8");
+    socket.on("connect", () => {
+      socket.write(`/session bench-${id}\n`);
+    });
+    socket.on("data", (chunk: string) => {
+      buffer += chunk;
+      let index = buffer.indexOf("</response>\n");
+      while (index >= 0) {
+        buffer = buffer.substring(index + 12);
+        completed++;
+        if (Date.now() >= deadline) {
+          socket.destroy();
+          resolve(completed);
+          return;
+        }
+        socket.write("hello\n");
+        index = buffer.indexOf("</response>\n");
+      }
+    });
+    socket.on("error", () => resolve(completed));
+  });
+}
+
+// セッション移動率（ノードを1つ追加したときに担当が変わるキーの割合）
+function movedFraction(nodes: number): number {
+  const before = new HashRing(160);
+  const after = new HashRing(160);
+  for (let i = 0; i < nodes; i++) {
+    before.add(`127.0.0.1:${BASE_PORT + i}`);
+    after.add(`127.0.0.1:${BASE_PORT + i}`);
+  }
+  after.add(`127.0.0.1:${BASE_PORT + nodes}`);
+  let moved = 0;
+  const keys = 10000;
+  for (let i = 0; i < keys; i++) {
+    if (before.lookup(`session:${i}`) !== after.lookup(`session:${i}`)) {
+      moved++;
+    }
+  }
+  return moved / keys;
+}
+
+async function main(): Promise<void> {
+  if (process.argv[2] === "backend") {
+    runBackend(Number.parseInt(process.argv[3], 10));
+    return;
+  }
+
+  const results = [];
+  for (const nodes of NODE_COUNTS) {
+    const ports = Array.from({ length: nodes }, (_, i) => BASE_PORT + i);
+    const children = await Promise.all(
+      ports.map((port) => spawn([__filename, "backend", String(port)], {}))
+    );
+
+    const proxyPort = BASE_PORT - 1;
+    const proxy = fork(path.join(__dirname, "../src/proxy.ts"), [], {
+      env: {
+        ...process.env,
+        PROXY_PORT: String(proxyPort),
+        PROXY_HOST: "127.0.0.1",
+        PROXY_BACKENDS: ports.map((port) => `127.0.0.1:${port}`).join(","),
+        PROXY_HEALTH_INTERVAL_MS: "60000",
+      },
+      stdio: ["ignore", "ignore", "inherit", "ipc"],
+    });
+    await waitForPort(proxyPort);
+
+    const start = Date.now();
+    const deadline = start + DURATION_MS;
+    const counts = await Promise.all(
+      Array.from({ length: CLIENTS }, (_, i) =>
+        runClient(proxyPort, i, deadline)
+      )
+    );
+    const elapsedSec = (Date.now() - start) / 1000;
+    const total = counts.reduce((a, b) => a + b, 0);
+
+    results.push({
+      nodes,
+      requests: total,
+      "req/s": Math.round(total / elapsedSec),
+      "moved on +1 node": `${(movedFraction(nodes) * 100).toFixed(1)}%`,
+    });
+
+    proxy.kill();
+    for (const child of children) {
+      child.kill();
+    }
+    await new Promise((resolve) => setTimeout(resolve, 200));
+  }
+
+  console.log(
+    `clients=${CLIENTS} work=${WORK_MS}ms duration=${DURATION_MS}ms`
+  );
+  console.table(results);
+  process.exit(0);
+}
+
+main();
@@ -0,0 +1,103 @@
+import { buildRequestBody, encodeMessageSegment } from "../src/requestBody";
+
+// リクエストボディ生成ベンチマーク
+// 会話履歴全体を毎回 JSON.stringify する従来の方法と、メッセージごとの
+// 変換済みセグメントを連結する方法で、1リクエストあたりのコストを比較する
+//
+// 使い方: npm run bench:body
+//   BENCH_HISTORY      履歴のメッセージ数（カンマ区切り、既定: 10,100,1000）
+//   BENCH_MESSAGE_KB   1メッセージのサイズ（既定: 2）
+//   BENCH_DURATION_MS  各測定の時間（既定: 2000）
+
+const HISTORY_SIZES = (process.env.BENCH_HISTORY || "10,100,1000")
+  .split(",")
+  .map((value) => Number.parseInt(value, 10));
+const MESSAGE_KB = Number.parseInt(process.env.BENCH_MESSAGE_KB || "2", 10);
+const DURATION_MS = Number.parseInt(
+  process.env.BENCH_DURATION_MS || "2000",
+  10
+);
+const MODEL = "gpt-4.1-nano-2025-04-14";
+
+type Message = { role: "system" | "user" | "assistant"; content: string };
+
+const encoder = new TextEncoder();
+
+// エスケープが必要な文字や日本語を含むメッセージ
+function makeMessage(index: number): Message {
+  const line = `${index}: "引用" と改行\n、タブ\tと <tag> & code {a: 1}\n`;
+  return {
+    role: index % 2 === 0 ? "user" : "assistant",
+    content: line.repeat(Math.ceil((MESSAGE_KB * 1024) / line.length)),
+  };
+}
+
+// 一定時間繰り返し、1回あたりの時間（マイクロ秒）を求める
+// step は1ターン分（新しいメッセージの追加とボディの生成）を行う
+function measure(step: (turn: number) => Uint8Array): {
+  usPerRequest: number;
+  bytes: number;
+} {
+  let turns = 0;
+  let bytes = 0;
+  const start = process.hrtime.bigint();
+  const deadline = start + BigInt(DURATION_MS) * 1000000n;
+  while (process.hrtime.bigint() < deadline) {
+    bytes += step(turns).byteLength;
+    turns++;
+  }
+  const elapsedUs = Number(process.hrtime.bigint() - start) / 1000;
+  return { usPerRequest: elapsedUs / turns, bytes: bytes / turns };
+}
+
+function main(): void {
+  const results = [];
+  for (const size of HISTORY_SIZES) {
+    const base: Message[] = [{ role: "system", content: "system prompt" }];
+    for (let i = 1; i < size; i++) {
+      base.push(makeMessage(i));
+    }
+    const extra = makeMessage(size);
+
+    // 同じバイト列になることを確認
+    const expected = encoder.encode(
+      JSON.stringify({ model: MODEL, messages: [...base, extra] })
+    );
+    const actual = buildRequestBody(
+      { model: MODEL },
+      [...base, extra].map(encodeMessageSegment)
+    );
+    if (Buffer.compare(Buffer.from(expected), Buffer.from(actual)) !== 0) {
+      throw new Error(`ボディが一致しません (history=${size})`);
+    }
+
+    // 従来: 履歴全体を毎回シリアライズ
+    const full = measure(() => {
+      const messages = [...base, extra];
+      return encoder.encode(JSON.stringify({ model: MODEL, messages }));
+    });
+
+    // セグメント連結: 新しいメッセージだけを変換
+    const segments = base.map(encodeMessageSegment);
+    const incremental = measure(() => {
+      const last = encodeMessageSegment(extra);
+      segments.push(last);
+      const body = buildRequestBody({ model: MODEL }, segments);
+      segments.pop();
+      return body;
+    });
+
+    results.push({
+      messages: size,
+      "body KB": Math.round(full.bytes / 1024),
+      "full us/req": Math.round(full.usPerRequest),
+      "segments us/req": Math.round(incremental.usPerRequest),
+      speedup: `${(full.usPerRequest / incremental.usPerRequest).toFixed(1)}x`,
+    });
+  }
+
+  console.log(`message=${MESSAGE_KB}KB duration=${DURATION_MS}ms`);
+  console.table(results);
+}
+
+main();
@@ -0,0 +1,334 @@
+/**
+ * Parser and rendering microbenchmark (make bench)
+ *
+ * Feeds process_response() a generated corpus and reports throughput,
+ * allocations per response and cycles per byte. process_response() decodes
+ * the content in place, so each run parses a fresh copy of the frame.
+ * Rendered output goes to /dev/null; the report is written to the original
+ * stdout.
+ *
+ * Usage: bin/parser-bench [name-filter]
+ *   BENCH_MIN_MS  Minimum measuring time per case (default: 1000)
+ *   BENCH_QUIET   1: render in quiet mode (compare the console bytes)
+ *   BENCH_WIDTH   Wrap the output at this many columns (default: 0, off)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "response.h"
+#include "render.h"
+#include "prof.h"
+
+/* Constants */
+#define DEFAULT_MIN_MS 1000L
+#define SPLIT_CONTENT_SIZE 4096  /* Content size of the split-boundary cases */
+
+/* Benchmark case */
+struct bench_case {
+    const char *name;
+    char *frame;
+    size_t len;
+    char *work;  /* Copy of the frame parsed by the whole-frame cases */
+    int split;  /* Feed through response_append() split at every byte boundary */
+};
+
+/* Measurement */
+struct bench_result {
+    unsigned long responses;
+    double bytes;
+    double seconds;
+    double cycles;  /* < 0 if the cycle counter is unavailable */
+    unsigned long allocs;
+    unsigned long mismatches;
+    double out_bytes;  /* Written to the console */
+};
+
+static const char ascii_text[] =
+    "The quick brown fox jumps over the lazy dog. ";
+static const char escaped_text[] =
+    "if (a &lt; b &amp;&amp; c &gt; d) { return &quot;x&quot;; }\n";
+static const char code_text[] =
+    "static int parse(const char *s, size_t len) {\n"
+    "    size_t i;\n"
+    "    for (i = 0; i &lt; len; i++) {\n"
+    "        if (s[i] == &apos;\\n&apos; &amp;&amp; depth &gt; 0) {\n"
+    "            return emit(&quot;line&quot;, i);\n"
+    "        }\n"
+    "        depth += weight(s[i]);\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n\n";  /* Code: most lines have no entity */
+static const char japanese_text[] =
+    "\xe5\x90\xbe\xe8\xbc\xa9\xe3\x81\xaf\xe7\x8c\xab\xe3\x81\xa7\xe3\x81\x82"
+    "\xe3\x82\x8b\xe3\x80\x82\xe5\x90\x8d\xe5\x89\x8d\xe3\x81\xaf\xe3\x81\xbe"
+    "\xe3\x81\xa0\xe7\x84\xa1\xe3\x81\x84\xe3\x80\x82\n";  /* A line of Japanese text */
+
+static const char clear_reply[] =
+    "<response>\n"
+    "  <type>command</type>\n"
+    "  <command>clear</command>\n"
+    "  <message>Conversation history cleared</message>\n"
+    "</response>\n";
+static const char models_reply[] =
+    "<response>\n"
+    "  <type>command</type>\n"
+    "  <command>models</command>\n"
+    "  <current_model>gpt-4o-mini</current_model>\n"
+    "  <available_models>\n"
+    "    <model>gpt-4o</model>\n"
+    "    <model>gpt-4o-mini</model>\n"
+    "    <model>gpt-4.1</model>\n"
+    "    <model>o3-mini</model>\n"
+    "  </available_models>\n"
+    "  <message>Use /model to change the model</message>\n"
+    "</response>\n";
+
+/**
+ * Seconds from the monotonic clock
+ */
+static double now_seconds(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    {
+        struct timeval tv;
+    
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+}
+
+/**
+ * Time stamp counter (reference cycles), or -1 where unavailable
+ */
+static double read_cycles(void) {
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    unsigned int lo, hi;
+    
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return hi * 4294967296.0 + lo;
+#else
+    return -1.0;
+#endif
+}
+
+/**
+ * Copy a string into a new buffer
+ */
+static char *copy_string(const char *str) {
+    size_t len = strlen(str);
+    char *copy = (char *)malloc(len + 1);
+    
+    if (copy == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+/**
+ * Build an AI response frame whose content repeats text to about size bytes
+ */
+static char *make_completion(const char *text, size_t size) {
+    static const char head[] = "<response>\n  <model>gpt-4o-mini</model>\n  <content>";
+    static const char tail[] = "</content>\n</response>\n";
+    size_t text_len = strlen(text);
+    size_t count = (size + text_len - 1) / text_len;
+    size_t pos;
+    size_t i;
+    char *frame;
+    
+    frame = (char *)malloc(sizeof(head) - 1 + count * text_len + sizeof(tail));
+    if (frame == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(frame, head, sizeof(head) - 1);
+    pos = sizeof(head) - 1;
+    for (i = 0; i < count; i++) {
+        memcpy(frame + pos, text, text_len);
+        pos += text_len;
+    }
+    memcpy(frame + pos, tail, sizeof(tail));
+    return frame;
+}
+
+/**
+ * Parse the whole frame repeatedly
+ */
+static void run_whole(struct bench_case *c, struct bench_result *r) {
+    struct response_buf buf = { NULL, 0, NULL, 0, 0, 0 };
+    unsigned long allocs = prof_alloc_calls();
+    
+    unsigned long out = render_bytes;
+    
+    memcpy(c->work, c->frame, c->len + 1);
+    buf.data = c->work;
+    buf.size = c->len;
+    process_response(&buf);
+    r->responses++;
+    r->bytes += c->len;
+    r->allocs += prof_alloc_calls() - allocs;
+    r->out_bytes += render_bytes - out;
+}
+
+/**
+ * Reassemble the frame from two reads split at every byte boundary, then
+ * parse it
+ */
+static void run_split(struct bench_case *c, struct bench_result *r) {
+    struct response_buf buf = { NULL, 0, NULL, 0, 0, 0 };
+    unsigned long allocs;
+    unsigned long out;
+    size_t i;
+    
+    for (i = 1; i < c->len; i++) {
+        out = render_bytes;
+        allocs = prof_alloc_calls();
+        response_append(&buf, c->frame, i);
+        response_append(&buf, c->frame + i, c->len - i);
+        if (buf.size != c->len || memcmp(buf.data, c->frame, c->len) != 0) {
+            r->mismatches++;
+        }
+        process_response(&buf);
+        r->allocs += prof_alloc_calls() - allocs;
+        r->out_bytes += render_bytes - out;
+    
+        response_reset(&buf);
+        r->responses++;
+        r->bytes += c->len;
+    }
+}
+
+/**
+ * Run one case for at least min_seconds
+ */
+static void run_case(struct bench_case *c, double min_seconds, struct bench_result *r) {
+    double start, start_cycles;
+    
+    memset(r, 0, sizeof(*r));
+    start = now_seconds();
+    start_cycles = read_cycles();
+    do {
+        if (c->split) {
+            run_split(c, r);
+        } else {
+            run_whole(c, r);
+        }
+        r->seconds = now_seconds() - start;
+    } while (r->seconds < min_seconds);
+    
+    r->cycles = start_cycles < 0 ? -1.0 : read_cycles() - start_cycles;
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_case cases[10];
+    struct bench_result r;
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    const char *value;
+    double min_seconds = DEFAULT_MIN_MS / 1000.0;
+    FILE *report;
+    int count = 0;
+    int i;
+    
+    value = getenv("BENCH_MIN_MS");
+    if (value != NULL && atol(value) > 0) {
+        min_seconds = atol(value) / 1000.0;
+    }
+    
+    value = getenv("BENCH_QUIET");
+    if (value != NULL) {
+        quiet = atoi(value) != 0;
+    }
+    value = getenv("BENCH_WIDTH");
+    if (value != NULL && atoi(value) > 0) {
+        render_width = atoi(value);
+    }
+    
+    /* Split cases are small, keep them in memory */
+    mem_cap = (size_t)-1;
+    
+    cases[count].name = "command-clear";
+    cases[count].frame = copy_string(clear_reply);
+    cases[count++].split = 0;
+    cases[count].name = "command-models";
+    cases[count].frame = copy_string(models_reply);
+    cases[count++].split = 0;
+    cases[count].name = "completion-100k";
+    cases[count].frame = make_completion(ascii_text, 100 * 1024);
+    cases[count++].split = 0;
+    cases[count].name = "completion-10m";
+    cases[count].frame = make_completion(ascii_text, 10 * 1024 * 1024);
+    cases[count++].split = 0;
+    cases[count].name = "escaped-100k";
+    cases[count].frame = make_completion(escaped_text, 100 * 1024);
+    cases[count++].split = 0;
+    cases[count].name = "code-1m";
+    cases[count].frame = make_completion(code_text, 1024 * 1024);
+    cases[count++].split = 0;
+    cases[count].name = "japanese-100k";
+    cases[count].frame = make_completion(japanese_text, 100 * 1024);
+    cases[count++].split = 0;
+    cases[count].name = "split-command";
+    cases[count].frame = copy_string(models_reply);
+    cases[count++].split = 1;
+    cases[count].name = "split-japanese-4k";
+    cases[count].frame = make_completion(japanese_text, SPLIT_CONTENT_SIZE);
+    cases[count++].split = 1;
+    cases[count].name = "split-escaped-4k";
+    cases[count].frame = make_completion(escaped_text, SPLIT_CONTENT_SIZE);
+    cases[count++].split = 1;
+    
+    /* Keep the report on the terminal and discard the rendered output */
+    fflush(stdout);
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("stdout");
+        return 1;
+    }
+    
+    fprintf(report, "%-20s %10s %10s %10s %12s %12s %10s\n",
+            "case", "bytes", "responses", "MB/s", "allocs/resp", "cycles/byte", "out/resp");
+    for (i = 0; i < count; i++) {
+        cases[i].len = strlen(cases[i].frame);
+        if (filter != NULL && strstr(cases[i].name, filter) == NULL) {
+            continue;
+        }
+        cases[i].work = copy_string(cases[i].frame);
+    
+        run_case(&cases[i], min_seconds, &r);
+    
+        fprintf(report, "%-20s %10lu %10lu %10.1f %12.2f ",
+                cases[i].name, (unsigned long)cases[i].len, r.responses,
+                r.bytes / r.seconds / (1024.0 * 1024.0),
+                (double)r.allocs / r.responses);
+        if (r.cycles < 0) {
+            fprintf(report, "%12s ", "-");
+        } else {
+            fprintf(report, "%12.2f ", r.cycles / r.bytes);
+        }
+        fprintf(report, "%10.0f\n", r.out_bytes / r.responses);
+        if (r.mismatches > 0) {
+            fprintf(report, "  %lu reassembled responses differ from the input\n",
+                    r.mismatches);
+        }
+        fflush(report);
+        free(cases[i].work);
+    }
+    
+    for (i = 0; i < count; i++) {
+        free(cases[i].frame);
+    }
+    fclose(report);
+    return 0;
+}
@@ -18,68 +18,136 @@
 #include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <time.h>
+
+#include "response.h"
+#include "render.h"
+#include "prof.h"
+#include "trace.h"
 
 /* Constants */
 #define DEFAULT_PORT 3000
 #define DEFAULT_HOST "127.0.0.1"
-#define BUFFER_SIZE 4096
 #define MAX_INPUT_SIZE 1024
 #define MAX_XML_SIZE 8192
+#define KEY_SIZE 32           /* Idempotency key buffer size */
+#define MAX_RESUME_ATTEMPTS 3 /* Reconnect attempts per request */
+#define MAX_SERVERS 8         /* Servers accepted on the command line */
+#define MAX_HOST_SIZE 256
+#define PROBE_TIMEOUT_MS 3000 /* Startup probe timeout */
+
+/* receive_message() status codes */
+#define RECV_COMPLETE 0       /* Response received */
+#define RECV_DISCONNECTED 1   /* Connection lost before the end of the response */
+#define RECV_TIMEOUT 2        /* A read deadline expired (see last_timeout) */
+#define RECV_ERROR -1         /* Unrecoverable error */
+#define RECV_NOT_SENT 3       /* Nothing was sent (e.g. unreadable batch file) */
+
+/* Read deadlines (milliseconds, 0 disables) */
+#define DEFAULT_FIRST_BYTE_TIMEOUT_MS 180000L  /* Request sent -> first byte */
+#define DEFAULT_CHUNK_TIMEOUT_MS 30000L        /* Gap between chunks */
+#define DEFAULT_TOTAL_TIMEOUT_MS 600000L       /* Request sent -> end of response */
+
+/* Deadline kinds */
+#define TIMEOUT_FIRST_BYTE 0
+#define TIMEOUT_CHUNK 1
+#define TIMEOUT_TOTAL 2
+
+/* Server list entry */
+struct server_entry {
+    char host[MAX_HOST_SIZE];
+    int port;
+    long rtt_ms;  /* Probe round-trip time (-1 if unreachable) */
+};
 
 /* Global variables */
 int sockfd = -1;  /* Socket file descriptor */
 int running = 1;  /* Program execution flag */
+unsigned long request_counter = 0;  /* Requests sent (used for idempotency keys) */
+struct server_entry servers[MAX_SERVERS];  /* Candidate servers */
+int server_order[MAX_SERVERS];  /* Server indices sorted by RTT */
+int server_count = 0;
+int current_rank = 0;  /* Position of the connected server in server_order */
+unsigned long failover_count = 0;  /* Successful reconnects */
+char session_id[KEY_SIZE];  /* Named session resumed after failover */
+struct response_buf last_response = { NULL, 0, NULL, 0, 0, 0 };  /* Kept for /save */
+long timeout_ms[3] = {  /* Indexed by TIMEOUT_* */
+    DEFAULT_FIRST_BYTE_TIMEOUT_MS, DEFAULT_CHUNK_TIMEOUT_MS, DEFAULT_TOTAL_TIMEOUT_MS
+};
+const char *timeout_env[3] = {
+    "CLIENT_FIRST_BYTE_TIMEOUT_MS", "CLIENT_CHUNK_TIMEOUT_MS", "CLIENT_TOTAL_TIMEOUT_MS"
+};
+unsigned long timeout_count[3] = { 0, 0, 0 };  /* Expiries per kind */
+int last_timeout = TIMEOUT_FIRST_BYTE;  /* Kind of the last expiry */
 
 /* Function prototypes */
 void cleanup(void);
 void signal_handler(int sig);
 void show_help(void);
+int resolve_address(const char *host, int port, struct sockaddr_in *addr);
 int connect_to_server(const char *host, int port);
+int parse_servers(int argc, char *argv[]);
+int probe_servers(void);
+int failover(void);
+int start_session(int sock);
+void show_client_stats(void);
+long elapsed_ms(const struct timeval *start, const struct timeval *end);
+long monotonic_ms(void);
 int send_message(int sock, const char *message);
-char *receive_message(int sock);
-void process_response(const char *response);
-char *extract_xml_content(const char *xml, const char *tag);
-void trim_string(char *str);
+int send_request(int sock, const char *key, size_t offset, const char *message);
+void make_request_key(char *key);
+void load_config(void);
+int receive_message(int sock, struct response_buf *response);
+int request_with_resume(const char *message, int use_key, struct response_buf *response);
+int write_all(int sock, const char *data, size_t len);
+int submit_batch(const char *args, struct response_buf *response);
 
 /**
  * Main function
  */
 int main(int argc, char *argv[]) {
-    char *host = DEFAULT_HOST;
-    int port = DEFAULT_PORT;
     char input[MAX_INPUT_SIZE];
-    char *response = NULL;
     size_t len;
+    int status;
+    long started;
+    long prompted;
     
-    /* Process command line arguments */
-    if (argc > 1) {
-        host = argv[1];
-    }
-    if (argc > 2) {
-        port = atoi(argv[2]);
-        if (port <= 0 || port > 65535) {
-            port = DEFAULT_PORT;
-        }
+    PROF_INIT();
+    
+    /* Process command line arguments and environment */
+    if (parse_servers(argc, argv) < 0) {
+        return 1;
     }
+    load_config();
+    
+    /* Seed generator for idempotency keys and name this client's session */
+    srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+    make_request_key(session_id);
     
     /* Set up signal handlers */
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    /* Report broken connections through write() instead of terminating */
+    signal(SIGPIPE, SIG_IGN);
     
-    /* Connect to server */
-    sockfd = connect_to_server(host, port);
+    /* Probe all servers in parallel and keep the fastest connection */
+    sockfd = probe_servers();
     if (sockfd < 0) {
         fprintf(stderr, "Failed to connect to server\n");
         return 1;
     }
+    start_session(sockfd);
     
-    printf("Connected to server (%s:%d)\n", host, port);
+    printf("Connected to server (%s:%d)\n",
+           servers[server_order[current_rank]].host,
+           servers[server_order[current_rank]].port);
     printf("Enter a message (type '/help' for commands, 'exit' to quit):\n");
     
     /* Main loop */
     while (running) {
         printf("> ");
         fflush(stdout);
+        prompted = monotonic_ms();
         
         /* Read input */
         if (fgets(input, MAX_INPUT_SIZE, stdin) == NULL) {
@@ -104,35 +172,83 @@ int main(int argc, char *argv[]) {
             continue;
         }
         
-        /* Send message to server */
-        if (send_message(sockfd, input) < 0) {
-            fprintf(stderr, "Failed to send message\n");
-            break;
+        /* Save the last response to a file */
+        if (strncmp(input, "/save ", 6) == 0) {
+            save_response(&last_response, input + 6);
+            continue;
+        }
+        
+        /* Toggle display of server timing and token usage */
+        if (strcmp(input, "/meta") == 0) {
+            show_meta = !show_meta;
+            printf("Response metadata display %s\n", show_meta ? "on" : "off");
+            continue;
+        }
+        
+        /* Toggle quiet mode (no banners or prompt lines around responses) */
+        if (strcmp(input, "/quiet") == 0) {
+            quiet = !quiet;
+            printf("Quiet mode %s\n", quiet ? "on" : "off");
+            continue;
         }
         
-        /* Receive response from server */
-        response = receive_message(sockfd);
-        if (response == NULL) {
+        /* Client-side statistics (server statistics follow) */
+        if (strcmp(input, "/stats") == 0) {
+            show_client_stats();
+        }
+        
+        /* Commands are cheap to repeat; chat messages carry an idempotency key.
+           Batch prompt files are streamed after the command line. */
+        started = monotonic_ms();
+        trace_id[0] = '\0';
+        if (strncmp(input, "/batch submit ", 14) == 0) {
+            status = submit_batch(input + 14, &last_response);
+            if (status == RECV_NOT_SENT) {
+                continue;
+            }
+        } else {
+            status = request_with_resume(input, input[0] != '/', &last_response);
+        }
+        response_elapsed_ms = monotonic_ms() - started;
+        trace_request(input, started - prompted, response_elapsed_ms,
+                      last_response.size,
+                      status == RECV_COMPLETE ? "ok" :
+                      status == RECV_TIMEOUT ? "timeout" : "error");
+        if (status == RECV_TIMEOUT && last_response.size == 0) {
+            /* Nothing to show; keep going on the fresh connection */
+            if (sockfd < 0) {
+                break;
+            }
+            continue;
+        }
+        if ((status != RECV_COMPLETE && status != RECV_TIMEOUT) || last_response.size == 0) {
             fprintf(stderr, "Failed to receive response\n");
             break;
         }
+        if (status == RECV_TIMEOUT) {
+            fprintf(stderr, "Showing partial response (%lu bytes)\n",
+                    (unsigned long)last_response.size);
+        }
         
-        /* Process response */
-        process_response(response);
-        
-        /* Free memory */
-        free(response);
-        response = NULL;
+        /* Process response (large responses are rendered from disk) */
+        if (last_response.spill) {
+            render_spilled_response(&last_response);
+        } else {
+            process_response(&last_response);
+        }
     }
     
     /* Cleanup */
+    response_reset(&last_response);
     cleanup();
+    trace_close();
     
     return 0;
 }
 
 /**
- * Cleanup function
+ * Close the connection (also used before each reconnect, so the trace file
+ * is closed separately on exit)
  */
 void cleanup(void) {
     if (sockfd >= 0) {
@@ -150,6 +266,7 @@ void signal_handler(int sig) {
     running = 0;
     printf("\nReceived termination signal. Exiting client...\n");
     cleanup();
+    trace_close();
     exit(0);
 }
 
@@ -162,10 +279,43 @@ void show_help(void) {
     printf("/clear  - Clear conversation history\n");
     printf("/models - Show available models and current model\n");
     printf("/model model_name - Change the model being used\n");
+    printf("/set [name value] - Show or change generation settings:\n");
+    printf("        max_tokens N, reasoning low|medium|high, temperature 0-2\n");
+    printf("        (use 'default' as the value to reset)\n");
+    printf("/stats  - Show connection and server statistics\n");
+    printf("/save path - Save the last response to a file\n");
+    printf("/meta   - Toggle display of server timing and token usage\n");
+    printf("/quiet  - Toggle quiet mode (no banners or prompt lines)\n");
+    printf("/batch submit path [name] - Run a prompt file (one per line) as a batch job\n");
+    printf("/batch [list|status id|results id|cancel id] - Manage batch jobs\n");
     printf("exit    - Exit the client\n");
     printf("========================\n\n");
 }
 
+/**
+ * Resolve host name and port into a socket address
+ */
+int resolve_address(const char *host, int port, struct sockaddr_in *addr) {
+    struct hostent *he;
+    
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    
+    /* Convert hostname to IP address */
+    addr->sin_addr.s_addr = inet_addr(host);
+    if (addr->sin_addr.s_addr == (in_addr_t)-1) {
+        he = gethostbyname(host);
+        if (he == NULL) {
+            fprintf(stderr, "Failed to resolve hostname: %s\n", host);
+            return -1;
+        }
+        memcpy(&addr->sin_addr, he->h_addr_list[0], he->h_length);
+    }
+    
+    return 0;
+}
+
 /**
  * Connect to server
  */
@@ -173,6 +323,11 @@ int connect_to_server(const char *host, int port) {
     struct sockaddr_in server_addr;
     int sock;
     
+    /* Set up server address */
+    if (resolve_address(host, port, &server_addr) < 0) {
+        return -1;
+    }
+    
     /* Create socket */
     sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
@@ -180,24 +335,6 @@ int connect_to_server(const char *host, int port) {
         return -1;
     }
     
-    /* Set up server address */
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    
-    /* Convert hostname to IP address */
-    server_addr.sin_addr.s_addr = inet_addr(host);
-    if (server_addr.sin_addr.s_addr == (in_addr_t)-1) {
-        struct hostent *he;
-        he = gethostbyname(host);
-        if (he == NULL) {
-            fprintf(stderr, "Failed to resolve hostname: %s\n", host);
-            close(sock);
-            return -1;
-        }
-        memcpy(&server_addr.sin_addr, he->h_addr_list[0], he->h_length);
-    }
-    
     /* Connect to server */
     if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("connect");
@@ -209,298 +346,691 @@ int connect_to_server(const char *host, int port) {
 }
 
 /**
- * Send message
+ * Parse the server list from the command line
+ *
+ * Accepts either the original "host [port]" form or any number of
+ * "host[:port]" entries.
  */
-int send_message(int sock, const char *message) {
-    char buffer[MAX_INPUT_SIZE + 2];  /* Message + newline + NULL terminator */
-    int len;
+int parse_servers(int argc, char *argv[]) {
+    int i;
+    char *colon;
+    size_t host_len;
     
-    /* Add newline to message */
-    sprintf(buffer, "%s\n", message);
-    len = strlen(buffer);
+    /* No arguments: default server */
+    if (argc < 2) {
+        strcpy(servers[0].host, DEFAULT_HOST);
+        servers[0].port = DEFAULT_PORT;
+        server_count = 1;
+        return 0;
+    }
     
-    /* Send message */
-    if (write(sock, buffer, len) != len) {
-        perror("write");
-        return -1;
+    /* Original form: host port */
+    if (argc == 3 && strchr(argv[1], ':') == NULL &&
+        strspn(argv[2], "0123456789") == strlen(argv[2])) {
+        strncpy(servers[0].host, argv[1], MAX_HOST_SIZE - 1);
+        servers[0].host[MAX_HOST_SIZE - 1] = '\0';
+        servers[0].port = atoi(argv[2]);
+        if (servers[0].port <= 0 || servers[0].port > 65535) {
+            servers[0].port = DEFAULT_PORT;
+        }
+        server_count = 1;
+        return 0;
+    }
+    
+    /* List form: host[:port] ... */
+    for (i = 1; i < argc && server_count < MAX_SERVERS; i++) {
+        colon = strrchr(argv[i], ':');
+        host_len = colon ? (size_t)(colon - argv[i]) : strlen(argv[i]);
+        if (host_len == 0 || host_len >= MAX_HOST_SIZE) {
+            fprintf(stderr, "Invalid server: %s\n", argv[i]);
+            return -1;
+        }
+        memcpy(servers[server_count].host, argv[i], host_len);
+        servers[server_count].host[host_len] = '\0';
+        servers[server_count].port = colon ? atoi(colon + 1) : DEFAULT_PORT;
+        if (servers[server_count].port <= 0 || servers[server_count].port > 65535) {
+            servers[server_count].port = DEFAULT_PORT;
+        }
+        server_count++;
+    }
+    if (i < argc) {
+        fprintf(stderr, "Too many servers (max %d), ignoring the rest\n", MAX_SERVERS);
     }
     
     return 0;
 }
 
 /**
- * Receive message
+ * Milliseconds between two times
  */
-char *receive_message(int sock) {
-    char buffer[BUFFER_SIZE];
-    char *response = NULL;
-    char *new_response;
-    size_t response_size = 0;
-    size_t total_size = 0;
-    ssize_t bytes_read;
-    int flags;
-    fd_set readfds;
-    struct timeval tv;
+long elapsed_ms(const struct timeval *start, const struct timeval *end) {
+    return (end->tv_sec - start->tv_sec) * 1000L +
+           (end->tv_usec - start->tv_usec) / 1000L;
+}
+
+/**
+ * Probe all servers in parallel with non-blocking connects
+ *
+ * Records each server's connect RTT, orders the servers by it and
+ * returns the connection to the fastest one (or -1 if none answered).
+ */
+int probe_servers(void) {
+    int fds[MAX_SERVERS];
+    struct sockaddr_in addr;
+    struct timeval start, now, tv;
+    fd_set writefds;
+    int i, j, tmp, maxfd, pending, err, flags;
+    socklen_t err_len;
+    long remaining;
     
-    /* Read response */
-    while ((bytes_read = read(sock, buffer, BUFFER_SIZE - 1)) > 0) {
-        buffer[bytes_read] = '\0';
+    gettimeofday(&start, NULL);
+    pending = 0;
+    
+    /* Start all connects */
+    for (i = 0; i < server_count; i++) {
+        fds[i] = -1;
+        servers[i].rtt_ms = -1;
+        server_order[i] = i;
         
-        /* Expand response buffer */
-        new_response = realloc(response, total_size + bytes_read + 1);
-        if (new_response == NULL) {
-            perror("realloc");
-            free(response);
-            return NULL;
-        }
-        response = new_response;
+        if (resolve_address(servers[i].host, servers[i].port, &addr) < 0) {
+            continue;
+        }
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (fds[i] < 0) {
+            perror("socket");
+            continue;
+        }
+        flags = fcntl(fds[i], F_GETFL, 0);
+        fcntl(fds[i], F_SETFL, flags | O_NONBLOCK);
+        
+        if (connect(fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            servers[i].rtt_ms = 0;
+        } else if (errno == EINPROGRESS) {
+            pending++;
+        } else {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+    
+    /* Wait for connects to complete */
+    while (pending > 0) {
+        gettimeofday(&now, NULL);
+        remaining = PROBE_TIMEOUT_MS - elapsed_ms(&start, &now);
+        if (remaining <= 0) {
+            break;
+        }
         
-        /* Add new data */
-        memcpy(response + total_size, buffer, bytes_read + 1);
-        total_size += bytes_read;
+        FD_ZERO(&writefds);
+        maxfd = -1;
+        for (i = 0; i < server_count; i++) {
+            if (fds[i] >= 0 && servers[i].rtt_ms < 0) {
+                FD_SET(fds[i], &writefds);
+                if (fds[i] > maxfd) {
+                    maxfd = fds[i];
+                }
+            }
+        }
         
-        /* Check for end of response (ends with newline) */
-        if (buffer[bytes_read - 1] == '\n') {
+        tv.tv_sec = remaining / 1000;
+        tv.tv_usec = (remaining % 1000) * 1000;
+        if (select(maxfd + 1, NULL, &writefds, NULL, &tv) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
             break;
         }
         
-        /* Timeout handling (switch to non-blocking mode) */
-        if (response_size == 0) {
-            flags = fcntl(sock, F_GETFL, 0);
-            fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-            response_size = total_size;
-        } else {
-            /* End if no data arrives for a certain time */
-            FD_ZERO(&readfds);
-            FD_SET(sock, &readfds);
-            
-            tv.tv_sec = 1;
-            tv.tv_usec = 0;
-            
-            if (select(sock + 1, &readfds, NULL, NULL, &tv) <= 0) {
+        gettimeofday(&now, NULL);
+        for (i = 0; i < server_count; i++) {
+            if (fds[i] < 0 || servers[i].rtt_ms >= 0 || !FD_ISSET(fds[i], &writefds)) {
+                continue;
+            }
+            err = 0;
+            err_len = sizeof(err);
+            getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &err, &err_len);
+            if (err == 0) {
+                servers[i].rtt_ms = elapsed_ms(&start, &now);
+            } else {
+                close(fds[i]);
+                fds[i] = -1;
+            }
+            pending--;
+        }
+    }
+    
+    /* Order servers by RTT, unreachable ones last */
+    for (i = 1; i < server_count; i++) {
+        for (j = i; j > 0; j--) {
+            long a = servers[server_order[j - 1]].rtt_ms;
+            long b = servers[server_order[j]].rtt_ms;
+            if (b < 0 || (a >= 0 && a <= b)) {
                 break;
             }
+            tmp = server_order[j - 1];
+            server_order[j - 1] = server_order[j];
+            server_order[j] = tmp;
+        }
+    }
+    current_rank = 0;
+    
+    /* Keep only the fastest connection */
+    for (i = 0; i < server_count; i++) {
+        if (fds[i] >= 0 && (i != server_order[0] || servers[i].rtt_ms < 0)) {
+            close(fds[i]);
+            fds[i] = -1;
         }
     }
     
-    /* Return socket to blocking mode */
-    if (response_size > 0) {
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
+    i = server_order[0];
+    if (fds[i] < 0) {
+        return -1;
+    }
+    flags = fcntl(fds[i], F_GETFL, 0);
+    fcntl(fds[i], F_SETFL, flags & ~O_NONBLOCK);
+    
+    return fds[i];
+}
+
+/**
+ * Reconnect to the next server in RTT order (the current one is tried last)
+ */
+int failover(void) {
+    int attempt, rank, sock;
+    struct server_entry *server;
+    
+    for (attempt = 1; attempt <= server_count; attempt++) {
+        rank = (current_rank + attempt) % server_count;
+        server = &servers[server_order[rank]];
+        sock = connect_to_server(server->host, server->port);
+        if (sock < 0) {
+            continue;
+        }
+        
+        current_rank = rank;
+        failover_count++;
+        fprintf(stderr, "Reconnected to server (%s:%d)\n", server->host, server->port);
+        
+        /* Resume the session (servers without replication start a new one) */
+        start_session(sock);
+        return sock;
     }
     
-    /* Error handling */
-    if (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-        perror("read");
-        free(response);
-        return NULL;
+    return -1;
+}
+
+/**
+ * Attach the connection to this client's named session
+ */
+int start_session(int sock) {
+    char command[KEY_SIZE + 16];
+    struct response_buf response = { NULL, 0, NULL, 0, 0, 0 };
+    int status;
+    
+    sprintf(command, "/session %s", session_id);
+    if (send_message(sock, command) < 0) {
+        return -1;
     }
+    status = receive_message(sock, &response);
+    response_reset(&response);
+    
+    return status == RECV_COMPLETE ? 0 : -1;
+}
+
+/**
+ * Display client-side connection statistics
+ */
+void show_client_stats(void) {
+    int rank;
+    struct server_entry *server;
     
-    return response;
+    server = &servers[server_order[current_rank]];
+    printf("\n=== Client Statistics ===\n");
+    printf("Server: %s:%d\n", server->host, server->port);
+    printf("Session: %s\n", session_id);
+    printf("Failovers: %lu\n", failover_count);
+    printf("Timeouts: first byte %lu, chunk gap %lu, total %lu\n",
+           timeout_count[TIMEOUT_FIRST_BYTE], timeout_count[TIMEOUT_CHUNK],
+           timeout_count[TIMEOUT_TOTAL]);
+    printf("Deadlines (ms): first byte %ld, chunk gap %ld, total %ld\n",
+           timeout_ms[TIMEOUT_FIRST_BYTE], timeout_ms[TIMEOUT_CHUNK],
+           timeout_ms[TIMEOUT_TOTAL]);
+    show_meta_stats();
+    printf("Console output: %lu bytes written, %lu bytes left out by quiet mode\n",
+           render_bytes, render_quiet_bytes);
+    printf("Servers (by startup RTT):\n");
+    for (rank = 0; rank < server_count; rank++) {
+        server = &servers[server_order[rank]];
+        if (server->rtt_ms >= 0) {
+            printf("  %c %s:%d - %ld ms\n", rank == current_rank ? '*' : ' ',
+                   server->host, server->port, server->rtt_ms);
+        } else {
+            printf("  %c %s:%d - unreachable\n", rank == current_rank ? '*' : ' ',
+                   server->host, server->port);
+        }
+    }
 }
 
 /**
- * Process response
+ * Send message
  */
-void process_response(const char *response) {
-    char *message;
-    char *current_model;
-    char *available_models_start;
-    char *available_models_end;
+int send_message(int sock, const char *message) {
+    char buffer[MAX_INPUT_SIZE + 2];  /* Message + newline + NULL terminator */
     int len;
-    char models[BUFFER_SIZE];
-    char *model;
-    char *content;
-    
-    /* Try to parse XML response */
-    if (response && response[0] == '<') {
-        /* Process command response */
-        if (strstr(response, "<response>") && strstr(response, "<type>command</type>")) {
-            printf("\n=== Command Execution Result ===\n");
-            
-            /* Display based on command type */
-            if (strstr(response, "<command>clear</command>")) {
-                message = extract_xml_content(response, "message");
-                if (message) {
-                    printf("%s\n", message);
-                    free(message);
-                }
-            } else if (strstr(response, "<command>models</command>")) {
-                current_model = extract_xml_content(response, "current_model");
-                message = extract_xml_content(response, "message");
-                
-                if (current_model) {
-                    printf("Current model: %s\n", current_model);
-                    free(current_model);
-                }
-                
-                /* Display available models */
-                available_models_start = strstr(response, "<available_models>");
-                available_models_end = strstr(response, "</available_models>");
-                
-                if (available_models_start && available_models_end) {
-                    available_models_start += strlen("<available_models>");
-                    len = available_models_end - available_models_start;
-                    
-                    if (len > 0 && len < BUFFER_SIZE) {
-                        /* Parse individual model tags */
-                        char *model_start = models;
-                        char *model_end;
-                        char model_name[256];
-                        
-                        strncpy(models, available_models_start, len);
-                        models[len] = '\0';
-                        
-                        printf("Available models:\n");
-                        
-                        
-                        
-                        while ((model_start = strstr(model_start, "<model>")) != NULL) {
-                            model_start += strlen("<model>");
-                            model_end = strstr(model_start, "</model>");
-                            
-                            if (model_end) {
-                                len = model_end - model_start;
-                                if (len > 0 && len < sizeof(model_name)) {
-                                    strncpy(model_name, model_start, len);
-                                    model_name[len] = '\0';
-                                    trim_string(model_name);
-                                    printf("  - %s\n", model_name);
-                                }
-                                model_start = model_end + strlen("</model>");
-                            } else {
-                                break;
-                            }
-                        }
-                    }
-                }
-                
-                if (message) {
-                    printf("%s\n", message);
-                    free(message);
-                }
-            } else if (strstr(response, "<command>model_change</command>")) {
-                char *message = extract_xml_content(response, "message");
-                if (message) {
-                    printf("%s\n", message);
-                    free(message);
-                }
-            } else {
-                /* Other command responses */
-                printf("%s\n", response);
+    
+    /* Add newline to message */
+    sprintf(buffer, "%s\n", message);
+    len = strlen(buffer);
+    
+    /* Send message */
+    if (write(sock, buffer, len) != len) {
+        perror("write");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Generate a client-side idempotency key for a request
+ */
+void make_request_key(char *key) {
+    request_counter++;
+    sprintf(key, "%08lx%04lx%04lx%04x",
+            (unsigned long)time(NULL) & 0xffffffffUL,
+            (unsigned long)getpid() & 0xffffUL,
+            request_counter & 0xffffUL,
+            (unsigned int)(rand() & 0xffff));
+}
+
+/**
+ * Write a whole buffer, retrying short writes
+ */
+int write_all(int sock, const char *data, size_t len) {
+    ssize_t n;
+    
+    while (len > 0) {
+        n = write(sock, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            perror("write");
+            return -1;
         }
-        /* Process AI response */
-        else if (strstr(response, "<model>") && strstr(response, "<content>")) {
-            model = extract_xml_content(response, "model");
-            content = extract_xml_content(response, "content");
-            
-            if (model && content) {
-                printf("\n=== AI Response ===\n");
-                printf("[Model: %s]\n", model);
-                printf("%s\n", content);
-                
-                free(model);
-                free(content);
-            } else {
-                /* Display as-is if parsing fails */
-                printf("\n=== Server Response ===\n");
-                printf("%s\n", response);
+        data += n;
+        len -= (size_t)n;
+    }
+    
+    return 0;
+}
+
+/**
+ * Submit a prompt file as a server-side batch job
+ *
+ * Sends "@lines=N /batch submit [name]" followed by the N lines of the
+ * file, then waits for the server's acknowledgement. The file is streamed
+ * twice (count, then send) so its size is not limited by memory.
+ */
+int submit_batch(const char *args, struct response_buf *response) {
+    char path[MAX_PATH_SIZE];
+    char header[MAX_INPUT_SIZE + 64];
+    char chunk[BUFFER_SIZE];
+    const char *name;
+    FILE *in;
+    size_t n, i, len;
+    unsigned long lines = 0;
+    char last = '\n';
+    
+    /* "path [name]" */
+    while (*args == ' ') {
+        args++;
+    }
+    for (len = 0; args[len] != '\0' && args[len] != ' ' && len < sizeof(path) - 1; len++) {
+        path[len] = args[len];
+    }
+    path[len] = '\0';
+    name = args + len;
+    while (*name == ' ') {
+        name++;
+    }
+    
+    in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return RECV_NOT_SENT;
+    }
+    
+    /* Count lines; a final line without a newline still counts */
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (chunk[i] == '\n') {
+                lines++;
             }
-        } else {
-            /* Other XML responses */
-            printf("\n=== Server Response ===\n");
-            printf("%s\n", response);
         }
-    } else {
-        /* Plain text */
-        printf("\n=== Server Response ===\n");
-        printf("%s\n", response);
+        last = chunk[n - 1];
+    }
+    if (last != '\n') {
+        lines++;
+    }
+    rewind(in);
+    
+    response_reset(response);
+    sprintf(header, "@lines=%lu /batch submit %s\n", lines, name);
+    if (write_all(sockfd, header, strlen(header)) < 0) {
+        fclose(in);
+        return RECV_DISCONNECTED;
+    }
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        if (write_all(sockfd, chunk, n) < 0) {
+            fclose(in);
+            return RECV_DISCONNECTED;
+        }
+    }
+    fclose(in);
+    if (last != '\n' && write_all(sockfd, "\n", 1) < 0) {
+        return RECV_DISCONNECTED;
     }
     
-    printf("\nEnter your next message (type '/help' for commands, 'exit' to quit):\n");
+    printf("Sent %lu lines from %s\n", lines, path);
+    return receive_message(sockfd, response);
 }
 
 /**
- * Extract content from XML tag
+ * Send message with idempotency key and resume offset
  */
-char *extract_xml_content(const char *xml, const char *tag) {
-    char start_tag[64];
-    char end_tag[64];
-    char *start_ptr, *end_ptr;
-    char *content = NULL;
+int send_request(int sock, const char *key, size_t offset, const char *message) {
+    char buffer[MAX_INPUT_SIZE + KEY_SIZE + TRACE_ID_SIZE + 64];
     int len;
     
-    /* Create tags */
-    sprintf(start_tag, "<%s>", tag);
-    sprintf(end_tag, "</%s>", tag);
+    /* Prefix attributes: @key=... @trace=... @meta=1 [@offset=...] */
+    if (offset > 0) {
+        sprintf(buffer, "@key=%s @trace=%s @meta=1 @offset=%lu %s\n",
+                key, trace_id, (unsigned long)offset, message);
+    } else {
+        sprintf(buffer, "@key=%s @trace=%s @meta=1 %s\n", key, trace_id, message);
+    }
+    len = strlen(buffer);
     
-    /* Find positions of start and end tags */
-    start_ptr = strstr(xml, start_tag);
-    if (start_ptr == NULL) {
-        return NULL;
+    /* Send message */
+    if (write(sock, buffer, len) != len) {
+        perror("write");
+        return -1;
     }
     
-    start_ptr += strlen(start_tag);
-    end_ptr = strstr(start_ptr, end_tag);
+    return 0;
+}
+
+/**
+ * Send a message and receive its response, failing over to the next
+ * server if the connection drops. Chat messages carry an idempotency key
+ * so the retry resumes from the last received byte.
+ */
+int request_with_resume(const char *message, int use_key, struct response_buf *response) {
+    char key[KEY_SIZE];
+    int attempts = 0;
+    int status;
+    int sent;
     
-    if (end_ptr == NULL) {
-        return NULL;
+    if (use_key) {
+        make_request_key(key);
+        trace_new_id();
     }
+    response_reset(response);
     
-    /* Calculate content length */
-    len = end_ptr - start_ptr;
+    sent = use_key ? send_request(sockfd, key, 0, message) : send_message(sockfd, message);
+    status = sent < 0 ? RECV_DISCONNECTED : receive_message(sockfd, response);
     
-    /* Allocate memory */
-    content = (char *)malloc(len + 1);
-    if (content == NULL) {
-        return NULL;
+    /* A stalled connection is treated like a lost one, unless the whole
+       response has run out of time */
+    while ((status == RECV_DISCONNECTED ||
+            (status == RECV_TIMEOUT && last_timeout != TIMEOUT_TOTAL)) &&
+           attempts < MAX_RESUME_ATTEMPTS) {
+        attempts++;
+        fprintf(stderr, "Connection %s after %lu bytes, resuming (%d/%d)...\n",
+                status == RECV_TIMEOUT ? "stalled" : "lost",
+                (unsigned long)response->size, attempts, MAX_RESUME_ATTEMPTS);
+        
+        /* Reconnect to the next available server */
+        cleanup();
+        sockfd = failover();
+        if (sockfd < 0) {
+            sleep(1);
+            continue;
+        }
+        
+        /* Retry with the same key; the server replays the stored response */
+        if (use_key) {
+            sent = send_request(sockfd, key, response->size, message);
+        } else {
+            response_reset(response);
+            sent = send_message(sockfd, message);
+        }
+        status = sent < 0 ? RECV_DISCONNECTED : receive_message(sockfd, response);
+    }
+    
+    /* The server may still answer the abandoned request; reconnect so the
+       late reply is not mistaken for the next one */
+    if (status == RECV_TIMEOUT) {
+        cleanup();
+        sockfd = failover();
     }
     
-    /* Copy content */
-    strncpy(content, start_ptr, len);
-    content[len] = '\0';
+    return status;
+}
+
+/**
+ * Receive message
+ *
+ * Appends to response (which may hold a partial response from an earlier
+ * connection). If the data received starts over with "<response>", the
+ * server could not resume and the partial response is discarded.
+ *
+ * Waits are bounded by three deadlines measured on the monotonic clock:
+ * time to first byte, gap between chunks and total time.
+ */
+int receive_message(int sock, struct response_buf *response) {
+    static const char *timeout_names[3] = {
+        "waiting for the first byte", "waiting for the next chunk", "receiving the response"
+    };
+    char buffer[BUFFER_SIZE];
+    char *data;
+    size_t resume_size = response->size;
+    ssize_t bytes_read;
+    int received = 0;
+    int kind, ready;
+    long start, last, now, wait, deadline;
+    fd_set readfds;
+    struct timeval tv;
+    
+    PROF_ENTER(PROF_RECEIVE_MESSAGE);
     
-    /* Trim string */
-    trim_string(content);
+    start = monotonic_ms();
+    last = start;
+    
+    for (;;) {
+        /* Nearest deadline for this phase */
+        now = monotonic_ms();
+        kind = -1;
+        wait = -1;
+        if (!received && timeout_ms[TIMEOUT_FIRST_BYTE] > 0) {
+            kind = TIMEOUT_FIRST_BYTE;
+            wait = start + timeout_ms[TIMEOUT_FIRST_BYTE] - now;
+        }
+        if (received && timeout_ms[TIMEOUT_CHUNK] > 0) {
+            kind = TIMEOUT_CHUNK;
+            wait = last + timeout_ms[TIMEOUT_CHUNK] - now;
+        }
+        if (timeout_ms[TIMEOUT_TOTAL] > 0) {
+            deadline = start + timeout_ms[TIMEOUT_TOTAL] - now;
+            if (kind < 0 || deadline < wait) {
+                kind = TIMEOUT_TOTAL;
+                wait = deadline;
+            }
+        }
+        
+        /* Deadline expired */
+        if (kind >= 0 && wait <= 0) {
+            last_timeout = kind;
+            timeout_count[kind]++;
+            fprintf(stderr, "Timed out %s (%ld ms, %s)\n",
+                    timeout_names[kind], timeout_ms[kind], timeout_env[kind]);
+            PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+            return RECV_TIMEOUT;
+        }
+        
+        /* Wait for data */
+        FD_ZERO(&readfds);
+        FD_SET(sock, &readfds);
+        if (kind >= 0) {
+            tv.tv_sec = wait / 1000;
+            tv.tv_usec = (wait % 1000) * 1000;
+        }
+        ready = select(sock + 1, &readfds, NULL, NULL, kind >= 0 ? &tv : NULL);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+            return RECV_ERROR;
+        }
+        if (ready == 0) {
+            continue;
+        }
+        
+        bytes_read = read(sock, buffer, BUFFER_SIZE - 1);
+        if (bytes_read < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            if (errno == ECONNRESET || errno == EPIPE) {
+                PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+                return RECV_DISCONNECTED;
+            }
+            perror("read");
+            PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+            return RECV_ERROR;
+        }
+        
+        /* Connection closed before the end of the response */
+        if (bytes_read == 0) {
+            PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+            return RECV_DISCONNECTED;
+        }
+        buffer[bytes_read] = '\0';
+        
+        /* Skip blank lines before the response (the server's formatted XML
+           ends with an extra newline, which may arrive in a later read) */
+        data = buffer;
+        if (response->size == 0) {
+            while (bytes_read > 0 && (*data == '\n' || *data == '\r')) {
+                data++;
+                bytes_read--;
+            }
+            if (bytes_read == 0) {
+                continue;
+            }
+        }
+        received = 1;
+        last = monotonic_ms();
+        
+        /* Server sent the whole response again instead of the remainder */
+        if (resume_size > 0 && response->size == resume_size &&
+            strncmp(data, "<response>", 10) == 0) {
+            response_reset(response);
+        }
+        
+        /* Add new data (spills to disk beyond mem_cap) */
+        if (response_append(response, data, bytes_read) < 0) {
+            response_reset(response);
+            PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+            return RECV_ERROR;
+        }
+        
+        /* Check for end of response (a newline inside the frame may also
+           happen to end a read) */
+        if (response_complete(response)) {
+            PROF_LEAVE(PROF_RECEIVE_MESSAGE);
+            return RECV_COMPLETE;
+        }
+    }
+}
+
+/**
+ * Milliseconds from a monotonic clock (falls back to the wall clock on
+ * systems without CLOCK_MONOTONIC)
+ */
+long monotonic_ms(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
     
-    return content;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (long)ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+    }
+#endif
+    {
+        struct timeval tv;
+        
+        gettimeofday(&tv, NULL);
+        return (long)tv.tv_sec * 1000L + tv.tv_usec / 1000L;
+    }
 }
 
 /**
- * Trim whitespace from beginning and end of string
+ * Load settings from environment variables
  */
-void trim_string(char *str) {
-    char *start = str;
-    char *end;
+void load_config(void) {
+    const char *value;
+    long n;
+    int i;
     
-    /* Do nothing if string is empty */
-    if (str == NULL || *str == '\0') {
-        return;
+    value = getenv("CLIENT_MEM_CAP");
+    if (value != NULL) {
+        n = atol(value);
+        if (n >= BUFFER_SIZE) {
+            mem_cap = (size_t)n;
+        }
+    }
+    
+    for (i = 0; i < 3; i++) {
+        value = getenv(timeout_env[i]);
+        if (value != NULL) {
+            n = atol(value);
+            if (n >= 0) {
+                timeout_ms[i] = n;
+            }
+        }
+    }
+    
+    value = getenv("CLIENT_SHOW_META");
+    if (value != NULL) {
+        show_meta = atoi(value) != 0;
     }
     
-    /* Skip leading whitespace */
-    while (*start && (*start == ' ' || *start == '\t' || *start == '\n' || *start == '\r')) {
-        start++;
+    value = getenv("CLIENT_QUIET");
+    if (value != NULL) {
+        quiet = atoi(value) != 0;
     }
     
-    /* String is all whitespace */
-    if (*start == '\0') {
-        *str = '\0';
-        return;
+    value = getenv("CLIENT_WIDTH");
+    if (value != NULL && atoi(value) >= 0) {
+        render_width = atoi(value);
     }
     
-    /* Find end of trailing whitespace */
-    end = start + strlen(start) - 1;
-    while (end > start && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) {
-        end--;
+    value = getenv("CLIENT_PAGER_LINES");
+    if (value != NULL && atoi(value) >= 0) {
+        render_page_lines = atoi(value);
     }
     
-    /* Set null terminator */
-    *(end + 1) = '\0';
+    value = getenv("CLIENT_SPILL_DIR");
+    if (value != NULL && strlen(value) > 0 && strlen(value) < MAX_PATH_SIZE - 16) {
+        strcpy(spill_dir, value);
+    }
     
-    /* Copy result back to original string (if needed) */
-    if (start != str) {
-        memmove(str, start, (end - start) + 2);
+    value = getenv("CLIENT_TRACE_FILE");
+    if (value != NULL && strlen(value) > 0) {
+        trace_open(value);
     }
 }
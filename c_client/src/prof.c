@@ -0,0 +1,202 @@
+/**
+ * Lightweight function-level profiling (make profile)
+ *
+ * Compiled to an empty object unless PROFILE (or PROFILE_HEAP) is defined.
+ */
+
+#define PROF_IMPL
+#include "prof.h"
+
+#if defined(PROFILE) || defined(PROFILE_HEAP)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+/* Allocation header (keeps the payload aligned) */
+union prof_header {
+    size_t size;
+    double align_d;
+    void *align_p;
+};
+
+static unsigned long malloc_calls = 0;
+static unsigned long realloc_calls = 0;
+static unsigned long free_calls = 0;
+static double bytes_allocated = 0.0;
+static size_t heap_current = 0;
+static size_t heap_peak = 0;
+
+#endif /* PROFILE || PROFILE_HEAP */
+
+#ifdef PROFILE
+
+/* Per-function counters */
+struct prof_counter {
+    const char *name;
+    unsigned long calls;
+    double total_us;
+    double max_us;
+    double started_us;
+};
+
+static struct prof_counter counters[PROF_COUNT] = {
+    { "receive_message", 0, 0.0, 0.0, 0.0 },
+    { "process_response", 0, 0.0, 0.0, 0.0 },
+    { "extract_xml_content", 0, 0.0, 0.0, 0.0 },
+    { "trim_string", 0, 0.0, 0.0, 0.0 },
+    { "take_xml_content", 0, 0.0, 0.0, 0.0 }
+};
+
+/**
+ * Microseconds from the monotonic clock
+ */
+static double prof_now_us(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+    }
+#endif
+    {
+        struct timeval tv;
+        
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec * 1000000.0 + tv.tv_usec;
+    }
+}
+
+/**
+ * Write the summary to stderr
+ */
+static void prof_report(void) {
+    int i;
+    
+    fprintf(stderr, "\n=== Profile ===\n");
+    fprintf(stderr, "%-20s %10s %12s %10s %10s\n",
+            "function", "calls", "total ms", "avg us", "max us");
+    for (i = 0; i < PROF_COUNT; i++) {
+        fprintf(stderr, "%-20s %10lu %12.3f %10.2f %10.2f\n",
+                counters[i].name, counters[i].calls,
+                counters[i].total_us / 1000.0,
+                counters[i].calls ? counters[i].total_us / counters[i].calls : 0.0,
+                counters[i].max_us);
+    }
+    fprintf(stderr, "malloc: %lu calls, realloc: %lu calls, free: %lu calls\n",
+            malloc_calls, realloc_calls, free_calls);
+    fprintf(stderr, "bytes allocated: %.0f, peak heap: %lu, in use at exit: %lu\n",
+            bytes_allocated, (unsigned long)heap_peak, (unsigned long)heap_current);
+}
+
+/**
+ * Register the exit-time summary
+ */
+void prof_init(void) {
+    atexit(prof_report);
+}
+
+/**
+ * Function entry
+ */
+void prof_enter(int id) {
+    counters[id].started_us = prof_now_us();
+}
+
+/**
+ * Function exit
+ */
+void prof_leave(int id) {
+    double elapsed = prof_now_us() - counters[id].started_us;
+    
+    counters[id].calls++;
+    counters[id].total_us += elapsed;
+    if (elapsed > counters[id].max_us) {
+        counters[id].max_us = elapsed;
+    }
+}
+
+#endif /* PROFILE */
+
+#if defined(PROFILE) || defined(PROFILE_HEAP)
+
+/**
+ * Track a change in live heap bytes (only growth counts as allocated)
+ */
+static void prof_account(size_t added, size_t removed) {
+    heap_current = heap_current + added - removed;
+    if (heap_current > heap_peak) {
+        heap_peak = heap_current;
+    }
+    if (added > removed) {
+        bytes_allocated += added - removed;
+    }
+}
+
+/**
+ * Counting malloc
+ */
+void *prof_malloc(size_t size) {
+    union prof_header *header;
+    
+    malloc_calls++;
+    header = (union prof_header *)malloc(sizeof(*header) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    prof_account(size, 0);
+    return header + 1;
+}
+
+/**
+ * Counting realloc
+ */
+void *prof_realloc(void *ptr, size_t size) {
+    union prof_header *header;
+    size_t old_size = 0;
+    
+    realloc_calls++;
+    header = NULL;
+    if (ptr != NULL) {
+        header = (union prof_header *)ptr - 1;
+        old_size = header->size;
+    }
+    header = (union prof_header *)realloc(header, sizeof(*header) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    prof_account(size, old_size);
+    return header + 1;
+}
+
+/**
+ * Counting free
+ */
+void prof_free(void *ptr) {
+    union prof_header *header;
+    
+    if (ptr == NULL) {
+        return;
+    }
+    free_calls++;
+    header = (union prof_header *)ptr - 1;
+    heap_current -= header->size;
+    free(header);
+}
+
+/**
+ * malloc and realloc calls so far
+ */
+unsigned long prof_alloc_calls(void) {
+    return malloc_calls + realloc_calls;
+}
+
+#else
+
+/* ISO C requires at least one declaration per translation unit */
+typedef int prof_unused;
+
+#endif /* PROFILE || PROFILE_HEAP */
@@ -0,0 +1,58 @@
+/**
+ * Lightweight function-level profiling (make profile)
+ *
+ * Built with -DPROFILE, the PROF_* macros time the instrumented functions
+ * on the monotonic clock and malloc/realloc/free are routed through
+ * counting wrappers. A summary is written to stderr at exit.
+ * -DPROFILE_HEAP enables only the allocation counters (used by make bench).
+ * Without either, every macro expands to nothing.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#if defined(PROFILE) || defined(PROFILE_HEAP)
+
+#include <stddef.h>
+
+void *prof_malloc(size_t size);
+void *prof_realloc(void *ptr, size_t size);
+void prof_free(void *ptr);
+unsigned long prof_alloc_calls(void);
+
+/* Count heap usage of the including file (prof.c uses the real functions) */
+#ifndef PROF_IMPL
+#define malloc(size) prof_malloc(size)
+#define realloc(ptr, size) prof_realloc(ptr, size)
+#define free(ptr) prof_free(ptr)
+#endif
+
+#endif /* PROFILE || PROFILE_HEAP */
+
+#ifdef PROFILE
+
+/* Instrumented functions */
+#define PROF_RECEIVE_MESSAGE 0
+#define PROF_PROCESS_RESPONSE 1
+#define PROF_EXTRACT_XML_CONTENT 2
+#define PROF_TRIM_STRING 3
+#define PROF_TAKE_XML_CONTENT 4
+#define PROF_COUNT 5
+
+void prof_init(void);
+void prof_enter(int id);
+void prof_leave(int id);
+
+#define PROF_INIT() prof_init()
+#define PROF_ENTER(id) prof_enter(id)
+#define PROF_LEAVE(id) prof_leave(id)
+
+#else
+
+#define PROF_INIT()
+#define PROF_ENTER(id)
+#define PROF_LEAVE(id)
+
+#endif /* PROFILE */
+
+#endif /* PROF_H */
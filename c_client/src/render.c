@@ -0,0 +1,285 @@
+/**
+ * Buffered console output for rendered responses
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "render.h"
+#include "prof.h"
+
+#define RENDER_LINE_SIZE 1024  /* Longest formatted line */
+#define RENDER_SLICE 4096      /* Text wrapped per buffer reservation */
+#define NO_SPACE ((size_t)-1)
+
+static const char more_prompt[] = "-- More (Enter: next page, q: skip the rest) --";
+static const char next_prompt[] =
+    "\nEnter your next message (type '/help' for commands, 'exit' to quit):\n";
+
+/* Settings */
+int render_width = 0;       /* CLIENT_WIDTH */
+int render_page_lines = 0;  /* CLIENT_PAGER_LINES */
+int quiet = 0;              /* CLIENT_QUIET, toggled by /quiet */
+
+/* Output counters (shown by /stats) */
+unsigned long render_bytes = 0;
+unsigned long render_quiet_bytes = 0;
+
+/* Output buffer, kept between responses */
+static char *render_buf = NULL;
+static size_t render_len = 0;
+static size_t render_cap = 0;
+
+/* Wrapping state */
+static int render_col = 0;              /* Column of the current line */
+static size_t space_at = NO_SPACE;      /* Last space on the line (index in render_buf) */
+static int space_col = 0;               /* Column just after that space */
+
+/* Pager state (per response) */
+static int page_shown = 0;  /* Lines shown on the current page */
+static int skipping = 0;    /* The rest of the response was skipped */
+
+/**
+ * Write everything to the console
+ */
+static void write_out(const char *data, size_t len) {
+    ssize_t n;
+    
+    while (len > 0) {
+        n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+        render_bytes += n;
+    }
+}
+
+/**
+ * Make room for extra bytes. Returns -1 if the buffer cannot grow.
+ */
+static int reserve(size_t extra) {
+    size_t cap = render_cap ? render_cap : RENDER_SLICE;
+    char *new_buf;
+    
+    if (render_len + extra <= render_cap) {
+        return 0;
+    }
+    while (cap < render_len + extra) {
+        cap *= 2;
+    }
+    new_buf = realloc(render_buf, cap);
+    if (new_buf == NULL) {
+        return -1;
+    }
+    render_buf = new_buf;
+    render_cap = cap;
+    return 0;
+}
+
+/**
+ * Columns taken by a character starting with byte c (0 for UTF-8
+ * continuation bytes). Characters from U+1000 up are counted as double
+ * width, which covers Japanese text.
+ */
+static int char_width(unsigned char c) {
+    if (c >= 0x20 && c < 0x7F) {
+        return 1;
+    }
+    if (c < 0x80) {
+        return c == '\t' ? 8 - render_col % 8 : 0;
+    }
+    if (c < 0xC0) {
+        return 0;
+    }
+    return c >= 0xE1 ? 2 : 1;
+}
+
+/**
+ * Append text, breaking lines longer than render_width at the last space
+ * (or anywhere if the line has none)
+ */
+static void append_wrapped(const char *data, size_t len) {
+    unsigned char c;
+    size_t i;
+    int w;
+    
+    for (i = 0; i < len; i++) {
+        c = (unsigned char)data[i];
+        if (c == '\n') {
+            render_buf[render_len++] = '\n';
+            render_col = 0;
+            space_at = NO_SPACE;
+            continue;
+        }
+    
+        w = char_width(c);
+        if (w > 0 && render_col + w > render_width && render_col > 0) {
+            if (space_at != NO_SPACE && render_col - space_col + w <= render_width) {
+                render_buf[space_at] = '\n';
+                render_col -= space_col;
+            } else {
+                render_buf[render_len++] = '\n';
+                render_col = 0;
+            }
+            space_at = NO_SPACE;
+            w = char_width(c);
+        }
+    
+        render_buf[render_len++] = (char)c;
+        render_col += w;
+        if (c == ' ') {
+            space_at = render_len - 1;
+            space_col = render_col;
+        }
+    }
+}
+
+/**
+ * Add response text to the output
+ */
+void render_text(const char *data, size_t len) {
+    size_t n;
+    
+    if (skipping) {
+        return;
+    }
+    while (len > 0) {
+        /* Wrapping inserts at most one newline per byte */
+        n = (render_width > 0 && len > RENDER_SLICE) ? RENDER_SLICE : len;
+        if (reserve(render_width > 0 ? n * 2 : n) < 0) {
+            render_flush();
+            write_out(data, len);
+            return;
+        }
+        if (render_width > 0) {
+            append_wrapped(data, n);
+        } else {
+            memcpy(render_buf + render_len, data, n);
+            render_len += n;
+        }
+        data += n;
+        len -= n;
+        if (render_len >= RENDER_FLUSH_SIZE) {
+            render_flush();
+        }
+    }
+}
+
+/**
+ * Add a string and a newline to the output
+ */
+void render_line(const char *str) {
+    render_text(str, strlen(str));
+    render_text("\n", 1);
+}
+
+/**
+ * Add a formatted line (up to RENDER_LINE_SIZE bytes) to the output
+ */
+void render_printf(const char *format, ...) {
+    char line[RENDER_LINE_SIZE];
+    va_list args;
+    int n;
+    
+    va_start(args, format);
+    n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) {
+        render_text(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+    }
+}
+
+/**
+ * Add a banner line, or count it if quiet mode leaves it out
+ */
+void render_banner(const char *format, ...) {
+    char line[RENDER_LINE_SIZE];
+    va_list args;
+    int n;
+    
+    va_start(args, format);
+    n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n <= 0) {
+        return;
+    }
+    if ((size_t)n >= sizeof(line)) {
+        n = sizeof(line) - 1;
+    }
+    if (quiet) {
+        render_quiet_bytes += n;
+    } else {
+        render_text(line, n);
+    }
+}
+
+/**
+ * Write output a page at a time, asking before each further page
+ */
+static void page_out(const char *p, const char *end) {
+    const char *q;
+    const char *nl;
+    char answer[16];
+    
+    while (p < end) {
+        q = p;
+        while (q < end && page_shown < render_page_lines) {
+            nl = memchr(q, '\n', end - q);
+            if (nl == NULL) {
+                q = end;
+                break;
+            }
+            q = nl + 1;
+            page_shown++;
+        }
+        write_out(p, q - p);
+        p = q;
+        if (p < end) {
+            write_out(more_prompt, sizeof(more_prompt) - 1);
+            if (fgets(answer, sizeof(answer), stdin) == NULL || answer[0] == 'q') {
+                skipping = 1;
+                return;
+            }
+            page_shown = 0;
+        }
+    }
+}
+
+/**
+ * Write the buffered output with one write() (per page if the pager is on;
+ * it is used only when both stdin and stdout are terminals)
+ */
+void render_flush(void) {
+    /* Keep the order with output written through stdio */
+    fflush(stdout);
+    
+    if (!skipping && render_len > 0) {
+        if (render_page_lines > 0 && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) {
+            page_out(render_buf, render_buf + render_len);
+        } else {
+            write_out(render_buf, render_len);
+        }
+    }
+    
+    render_len = 0;
+    space_at = NO_SPACE;
+}
+
+/**
+ * End a response: add the prompt line and write everything out
+ */
+void render_finish(void) {
+    render_banner(next_prompt);
+    render_flush();
+    skipping = 0;
+    page_shown = 0;
+}
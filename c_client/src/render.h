@@ -0,0 +1,34 @@
+/**
+ * Buffered console output for rendered responses
+ *
+ * A response is assembled in one buffer and written with a single write()
+ * instead of many printf() calls, which matters on 9600-baud serial
+ * consoles. Lines can be wrapped to the console width (CLIENT_WIDTH), long
+ * answers are paged (CLIENT_PAGER_LINES) and quiet mode (CLIENT_QUIET,
+ * /quiet) leaves out the banner and prompt lines.
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+
+#define RENDER_FLUSH_SIZE 65536  /* Buffered bytes written out early (spilled responses) */
+
+/* Settings */
+extern int render_width;       /* Columns to wrap at, 0: no wrapping */
+extern int render_page_lines;  /* Lines per page, 0: no pager */
+extern int quiet;              /* Leave out banners and the prompt line */
+
+/* Bytes written to the console, and bytes left out by quiet mode */
+extern unsigned long render_bytes;
+extern unsigned long render_quiet_bytes;
+
+void render_text(const char *data, size_t len);
+void render_line(const char *str);
+void render_printf(const char *format, ...);
+void render_banner(const char *format, ...);
+void render_flush(void);
+void render_finish(void);
+
+#endif /* RENDER_H */
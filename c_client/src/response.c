@@ -0,0 +1,924 @@
+/**
+ * Response buffering, parsing and rendering
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "response.h"
+#include "render.h"
+#include "prof.h"
+#include "trace.h"
+
+/* Settings */
+size_t mem_cap = DEFAULT_MEM_CAP;  /* CLIENT_MEM_CAP */
+char spill_dir[MAX_PATH_SIZE] = DEFAULT_SPILL_DIR;  /* CLIENT_SPILL_DIR */
+int show_meta = 0;  /* CLIENT_SHOW_META, toggled by /meta */
+
+/* Response metadata */
+long response_elapsed_ms = -1;
+struct meta_totals meta_totals;
+
+/* Longest entity decoded, "&" and ";" included (&#x10FFFF; is 10) */
+#define MAX_ENTITY_SIZE 12
+
+/* Internal prototypes */
+static void report_response_meta(const char *xml);
+static size_t decode_entity(const char *src, size_t len, char *dst, size_t *used);
+
+/**
+ * Release a response buffer
+ */
+void response_reset(struct response_buf *response) {
+    free(response->data);
+    response->data = NULL;
+    if (response->spill) {
+        fclose(response->spill);
+        response->spill = NULL;
+    }
+    response->size = 0;
+    response->decoded = 0;
+    response->content_offset = 0;
+    response->content_len = 0;
+}
+
+/**
+ * Append received data, moving the response to a temporary file once it
+ * grows beyond mem_cap
+ */
+int response_append(struct response_buf *response, const char *data, size_t len) {
+    char path[MAX_PATH_SIZE + 16];
+    char *new_data;
+    int fd;
+    
+    /* Switch to a temporary file (unlinked right away, removed on close) */
+    if (response->spill == NULL && response->size + len > mem_cap) {
+        sprintf(path, "%s/clientXXXXXX", spill_dir);
+        fd = mkstemp(path);
+        if (fd < 0) {
+            perror("mkstemp");
+            return -1;
+        }
+        unlink(path);
+        response->spill = fdopen(fd, "w+b");
+        if (response->spill == NULL) {
+            perror("fdopen");
+            close(fd);
+            return -1;
+        }
+        if (response->size > 0 &&
+            fwrite(response->data, 1, response->size, response->spill) != response->size) {
+            perror("fwrite");
+            return -1;
+        }
+        free(response->data);
+        response->data = NULL;
+    }
+    
+    if (response->spill) {
+        if (fwrite(data, 1, len, response->spill) != len) {
+            perror("fwrite");
+            return -1;
+        }
+        response->size += len;
+        return 0;
+    }
+    
+    /* Expand response buffer */
+    new_data = realloc(response->data, response->size + len + 1);
+    if (new_data == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    response->data = new_data;
+    
+    /* Add new data */
+    memcpy(response->data + response->size, data, len);
+    response->size += len;
+    response->data[response->size] = '\0';
+    
+    return 0;
+}
+
+/**
+ * Copy up to len bytes of the response starting at offset
+ */
+size_t response_read(struct response_buf *response, size_t offset, char *buf, size_t len) {
+    if (offset >= response->size) {
+        return 0;
+    }
+    if (len > response->size - offset) {
+        len = response->size - offset;
+    }
+    if (response->spill) {
+        fflush(response->spill);
+        if (fseek(response->spill, (long)offset, SEEK_SET) != 0) {
+            return 0;
+        }
+        return fread(buf, 1, len, response->spill);
+    }
+    memcpy(buf, response->data + offset, len);
+    return len;
+}
+
+/**
+ * Check whether the whole response has arrived. XML responses end with
+ * "</response>" followed by a newline (the server's formatted XML may add
+ * more blank lines); anything else ends with a newline.
+ */
+int response_complete(struct response_buf *response) {
+    static const char end_tag[] = "</response>";
+    char tail[sizeof(end_tag) + 15];
+    size_t tag_len = sizeof(end_tag) - 1;
+    size_t len;
+    char first;
+    
+    if (response->size == 0 || response_read(response, 0, &first, 1) != 1) {
+        return 0;
+    }
+    if (response_read(response, response->size - 1, tail, 1) != 1 || tail[0] != '\n') {
+        return 0;
+    }
+    if (first != '<') {
+        return 1;
+    }
+    
+    /* Skip the trailing whitespace, then look for the closing tag */
+    len = response->size < sizeof(tail) ? response->size : sizeof(tail);
+    if (response_read(response, response->size - len, tail, len) != len) {
+        return 0;
+    }
+    while (len > 0 && (tail[len - 1] == ' ' || tail[len - 1] == '\t' ||
+                       tail[len - 1] == '\n' || tail[len - 1] == '\r')) {
+        len--;
+    }
+    return len >= tag_len && memcmp(tail + len - tag_len, end_tag, tag_len) == 0;
+}
+
+/**
+ * Write content to a file, or to the console renderer if out is NULL
+ */
+static void content_write(FILE *out, const char *data, size_t len) {
+    if (out) {
+        fwrite(data, 1, len, out);
+    } else {
+        render_text(data, len);
+    }
+}
+
+/**
+ * Write the <content> of a response to out (NULL: the console) in chunks,
+ * trimming leading and trailing whitespace and decoding entities. Returns 1
+ * if a <content> element was found.
+ *
+ * If process_response() already decoded the content in place, the recorded
+ * span is written as is: decoded text may contain "</content>" (from
+ * "&lt;/content&gt;"), so the buffer must not be scanned for tags again.
+ */
+int stream_content(struct response_buf *response, FILE *out) {
+    static const char open_tag[] = "<content>";
+    static const char close_tag[] = "</content>";
+    char chunk[BUFFER_SIZE];
+    char spaces[BUFFER_SIZE];
+    char entity[MAX_ENTITY_SIZE];
+    char decoded[4];
+    size_t offset = 0;
+    size_t n, i;
+    size_t matched = 0;    /* Characters of the current tag matched so far */
+    size_t held = 0;       /* Whitespace held back in case it is trailing */
+    size_t entity_len = 0; /* Characters of a possible entity collected so far */
+    size_t decoded_len;
+    size_t used;
+    int state = 0;         /* 0: before content, 1: leading space, 2: content */
+    char c;
+    
+    if (response->decoded) {
+        n = response->content_len;
+        while (n > 0) {
+            c = response->data[response->content_offset + n - 1];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                break;
+            }
+            n--;
+        }
+        content_write(out, response->data + response->content_offset, n);
+        return 1;
+    }
+    
+    while ((n = response_read(response, offset, chunk, sizeof(chunk))) > 0) {
+        offset += n;
+        for (i = 0; i < n; i++) {
+            c = chunk[i];
+            
+            /* Look for the opening tag */
+            if (state == 0) {
+                matched = (c == open_tag[matched]) ? matched + 1 : (c == '<');
+                if (matched == sizeof(open_tag) - 1) {
+                    state = 1;
+                    matched = 0;
+                }
+                continue;
+            }
+            
+            /* Skip leading whitespace */
+            if (state == 1) {
+                if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                    continue;
+                }
+                state = 2;
+            }
+            
+            /* Entity (possibly split across chunks) */
+            if (entity_len > 0) {
+                if (c == ';') {
+                    entity[entity_len++] = c;
+                    decoded_len = decode_entity(entity, entity_len, decoded, &used);
+                    if (decoded_len > 0) {
+                        content_write(out, decoded, decoded_len);
+                    } else {
+                        content_write(out, entity, entity_len);
+                    }
+                    entity_len = 0;
+                    continue;
+                }
+                if (c != '<' && c != '&' && c != ' ' && c != '\t' && c != '\n' &&
+                    c != '\r' && entity_len < MAX_ENTITY_SIZE - 1) {
+                    entity[entity_len++] = c;
+                    continue;
+                }
+                /* Not an entity after all: emit it as is */
+                content_write(out, entity, entity_len);
+                entity_len = 0;
+            }
+            
+            /* Closing tag (possibly split across chunks) */
+            if (c == close_tag[matched]) {
+                matched++;
+                if (matched == sizeof(close_tag) - 1) {
+                    return 1;
+                }
+                continue;
+            }
+            if (matched > 0) {
+                /* Not the closing tag after all: emit the held characters */
+                if (held > 0) {
+                    content_write(out, spaces, held);
+                    held = 0;
+                }
+                content_write(out, close_tag, matched);
+                matched = 0;
+                if (c == '<') {
+                    matched = 1;
+                    continue;
+                }
+            }
+            
+            /* Hold whitespace until something follows it */
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                if (held == sizeof(spaces)) {
+                    content_write(out, spaces, held);
+                    held = 0;
+                }
+                spaces[held++] = c;
+                continue;
+            }
+            if (held > 0) {
+                content_write(out, spaces, held);
+                held = 0;
+            }
+            if (c == '&') {
+                entity[0] = c;
+                entity_len = 1;
+                continue;
+            }
+            content_write(out, &c, 1);
+        }
+    }
+    
+    return state != 0;
+}
+
+/**
+ * Render a response that was spilled to disk without loading it
+ */
+void render_spilled_response(struct response_buf *response) {
+    char head[BUFFER_SIZE];
+    size_t n;
+    char *model;
+    char *message;
+    
+    /* The model (or command message) precedes the content, so the first
+       block is enough */
+    n = response_read(response, 0, head, sizeof(head) - 1);
+    head[n] = '\0';
+    
+    if (strstr(head, "<type>command</type>")) {
+        /* Large command results such as /batch results */
+        render_banner("\n=== Command Execution Result ===\n");
+        message = extract_xml_content(head, "message");
+        if (message) {
+            render_line(message);
+            free(message);
+        }
+    } else {
+        model = extract_xml_content(head, "model");
+        render_banner("\n=== AI Response ===\n");
+        if (model) {
+            render_banner("[Model: %s]\n", model);
+            free(model);
+        }
+    }
+    if (stream_content(response, NULL)) {
+        render_text("\n", 1);
+    } else {
+        render_printf("(%lu bytes received; use /save to write it to a file)\n",
+                      (unsigned long)response->size);
+    }
+    
+    /* The metadata also precedes the content */
+    report_response_meta(head);
+    
+    render_finish();
+}
+
+/**
+ * Save the last response's content (or the raw response) to a file
+ */
+int save_response(struct response_buf *response, const char *path) {
+    FILE *out;
+    char chunk[BUFFER_SIZE];
+    size_t offset = 0;
+    size_t n;
+    
+    while (*path == ' ') {
+        path++;
+    }
+    if (response->size == 0) {
+        printf("No response to save\n");
+        return -1;
+    }
+    
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+    
+    /* Stream the content; fall back to the raw response if there is none */
+    if (!stream_content(response, out)) {
+        rewind(out);
+        while ((n = response_read(response, offset, chunk, sizeof(chunk))) > 0) {
+            fwrite(chunk, 1, n, out);
+            offset += n;
+        }
+    }
+    
+    if (fclose(out) != 0) {
+        perror(path);
+        return -1;
+    }
+    printf("Saved last response to %s\n", path);
+    return 0;
+}
+
+/**
+ * Process response. The content is decoded in place, and its span is
+ * recorded so /save can write the decoded text without parsing it again.
+ */
+void process_response(struct response_buf *buf) {
+    char *response = buf->data;
+    char *message;
+    char *current_model;
+    char *available_models_start;
+    char *available_models_end;
+    int len;
+    char models[BUFFER_SIZE];
+    char *model;
+    char *content;
+    size_t content_len;
+    
+    PROF_ENTER(PROF_PROCESS_RESPONSE);
+    
+    /* Try to parse XML response */
+    if (response && response[0] == '<') {
+        /* Process command response */
+        if (strstr(response, "<response>") && strstr(response, "<type>command</type>")) {
+            render_banner("\n=== Command Execution Result ===\n");
+            
+            /* Display based on command type */
+            if (strstr(response, "<command>clear</command>")) {
+                message = extract_xml_content(response, "message");
+                if (message) {
+                    render_line(message);
+                    free(message);
+                }
+            } else if (strstr(response, "<command>models</command>")) {
+                current_model = extract_xml_content(response, "current_model");
+                message = extract_xml_content(response, "message");
+                
+                if (current_model) {
+                    render_printf("Current model: %s\n", current_model);
+                    free(current_model);
+                }
+                
+                /* Display available models */
+                available_models_start = strstr(response, "<available_models>");
+                available_models_end = strstr(response, "</available_models>");
+                
+                if (available_models_start && available_models_end) {
+                    available_models_start += strlen("<available_models>");
+                    len = available_models_end - available_models_start;
+                    
+                    if (len > 0 && len < BUFFER_SIZE) {
+                        /* Parse individual model tags */
+                        char *model_start = models;
+                        char *model_end;
+                        char model_name[256];
+                        
+                        strncpy(models, available_models_start, len);
+                        models[len] = '\0';
+                        
+                        render_line("Available models:");
+                        
+                        
+                        
+                        while ((model_start = strstr(model_start, "<model>")) != NULL) {
+                            model_start += strlen("<model>");
+                            model_end = strstr(model_start, "</model>");
+                            
+                            if (model_end) {
+                                len = model_end - model_start;
+                                if (len > 0 && (size_t)len < sizeof(model_name)) {
+                                    strncpy(model_name, model_start, len);
+                                    model_name[len] = '\0';
+                                    trim_string(model_name);
+                                    render_printf("  - %s\n", model_name);
+                                }
+                                model_start = model_end + strlen("</model>");
+                            } else {
+                                break;
+                            }
+                        }
+                    }
+                }
+                
+                if (message) {
+                    render_line(message);
+                    free(message);
+                }
+            } else if (strstr(response, "<command>model_change</command>")) {
+                char *message = extract_xml_content(response, "message");
+                if (message) {
+                    render_line(message);
+                    free(message);
+                }
+            } else if (strstr(response, "<command>batch</command>")) {
+                /* Job status, followed by the results if requested */
+                message = extract_xml_content(response, "message");
+                content = take_xml_content(response, "content", &content_len);
+                if (message) {
+                    render_line(message);
+                    free(message);
+                }
+                if (content) {
+                    buf->decoded = 1;
+                    buf->content_offset = content - response;
+                    buf->content_len = content_len;
+                    render_text("\n", 1);
+                    render_text(content, content_len);
+                    render_text("\n", 1);
+                }
+            } else {
+                /* Other command responses (session, stats, ...) */
+                message = extract_xml_content(response, "message");
+                if (message) {
+                    render_line(message);
+                    free(message);
+                } else {
+                    render_line(response);
+                }
+            }
+        }
+        /* Process AI response */
+        else if (strstr(response, "<model>") && strstr(response, "<content>")) {
+            model = extract_xml_content(response, "model");
+            content = model ? take_xml_content(response, "content", &content_len) : NULL;
+            
+            if (model && content) {
+                buf->decoded = 1;
+                buf->content_offset = content - response;
+                buf->content_len = content_len;
+                render_banner("\n=== AI Response ===\n");
+                render_banner("[Model: %s]\n", model);
+                render_text(content, content_len);
+                render_text("\n", 1);
+                report_response_meta(response);
+                
+                free(model);
+            } else {
+                free(model);
+                /* Display as-is if parsing fails */
+                render_banner("\n=== Server Response ===\n");
+                render_line(response);
+            }
+        } else {
+            /* Other XML responses */
+            render_banner("\n=== Server Response ===\n");
+            render_line(response);
+        }
+    } else {
+        /* Plain text */
+        render_banner("\n=== Server Response ===\n");
+        render_line(response);
+    }
+    
+    render_finish();
+    
+    PROF_LEAVE(PROF_PROCESS_RESPONSE);
+}
+
+/**
+ * Skip leading whitespace
+ */
+static char *skip_space(char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Write a code point to dst as UTF-8. Returns the number of bytes.
+ */
+static size_t encode_utf8(unsigned long code, char *dst) {
+    if (code < 0x80) {
+        dst[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        dst[0] = (char)(0xC0 | (code >> 6));
+        dst[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        dst[0] = (char)(0xE0 | (code >> 12));
+        dst[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    dst[0] = (char)(0xF0 | (code >> 18));
+    dst[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+/**
+ * Decode the entity at src (which starts with '&', len bytes available)
+ * into dst. Returns the number of bytes written, or 0 if it is not an
+ * entity; *used is set to its length. The output is never longer than the
+ * entity, so dst may point into src.
+ */
+static size_t decode_entity(const char *src, size_t len, char *dst, size_t *used) {
+    const char *p;
+    const char *end;
+    unsigned long code = 0;
+    int hex;
+    int digit;
+    
+    /* Predefined entities */
+    if (len >= 4 && src[2] == 't' && src[3] == ';' && (src[1] == 'l' || src[1] == 'g')) {
+        dst[0] = (src[1] == 'l') ? '<' : '>';
+        *used = 4;
+        return 1;
+    }
+    if (len >= 5 && memcmp(src + 1, "amp;", 4) == 0) {
+        dst[0] = '&';
+        *used = 5;
+        return 1;
+    }
+    if (len >= 6 && (memcmp(src + 1, "quot;", 5) == 0 || memcmp(src + 1, "apos;", 5) == 0)) {
+        dst[0] = (src[1] == 'q') ? '"' : '\'';
+        *used = 6;
+        return 1;
+    }
+    
+    /* Character reference (&#60; or &#x3C;) */
+    if (len < 4 || src[1] != '#') {
+        return 0;
+    }
+    hex = (src[2] == 'x' || src[2] == 'X');
+    p = src + (hex ? 3 : 2);
+    end = src + (len < MAX_ENTITY_SIZE ? len : MAX_ENTITY_SIZE);
+    for (; p < end && *p != ';'; p++) {
+        if (*p >= '0' && *p <= '9') {
+            digit = *p - '0';
+        } else if (hex && *p >= 'a' && *p <= 'f') {
+            digit = *p - 'a' + 10;
+        } else if (hex && *p >= 'A' && *p <= 'F') {
+            digit = *p - 'A' + 10;
+        } else {
+            return 0;
+        }
+        code = code * (hex ? 16 : 10) + digit;
+        if (code > 0x10FFFF) {
+            return 0;
+        }
+    }
+    if (p == end || p == src + (hex ? 3 : 2) || code == 0 ||
+        (code >= 0xD800 && code <= 0xDFFF)) {
+        return 0;
+    }
+    *used = p - src + 1;
+    return encode_utf8(code, dst);
+}
+
+/**
+ * Copy text from src to dst, decoding entities and dropping trailing
+ * whitespace, in one pass. Runs without '&' are found with memchr() and
+ * copied whole (not at all when decoding in place before the first entity).
+ * dst may equal src. Returns the length written.
+ */
+static size_t decode_text(char *dst, const char *src, const char *end) {
+    char *out = dst;
+    const char *amp;
+    size_t span;
+    size_t used;
+    size_t n;
+    
+    while (src < end) {
+        amp = (const char *)memchr(src, '&', end - src);
+        span = (amp ? amp : end) - src;
+        if (out != src) {
+            memmove(out, src, span);
+        }
+        out += span;
+        src += span;
+        if (amp == NULL) {
+            break;
+        }
+        n = decode_entity(src, end - src, out, &used);
+        if (n > 0) {
+            out += n;
+            src += used;
+        } else {
+            *out++ = *src++;
+        }
+    }
+    
+    /* Trim trailing whitespace */
+    while (out > dst && (out[-1] == ' ' || out[-1] == '\t' ||
+                         out[-1] == '\n' || out[-1] == '\r')) {
+        out--;
+    }
+    return out - dst;
+}
+
+/**
+ * Find the text of an element. Returns its start and sets *end, or NULL.
+ */
+static char *find_element(const char *xml, const char *tag, char **end) {
+    char start_tag[64];
+    char end_tag[64];
+    char *start_ptr;
+    
+    /* Create tags */
+    sprintf(start_tag, "<%s>", tag);
+    sprintf(end_tag, "</%s>", tag);
+    
+    /* Find positions of start and end tags */
+    start_ptr = strstr(xml, start_tag);
+    if (start_ptr == NULL) {
+        return NULL;
+    }
+    start_ptr += strlen(start_tag);
+    *end = strstr(start_ptr, end_tag);
+    return *end ? start_ptr : NULL;
+}
+
+/**
+ * Extract content from XML tag (trimmed and decoded, in a new buffer)
+ */
+char *extract_xml_content(const char *xml, const char *tag) {
+    char *start_ptr, *end_ptr;
+    char *content = NULL;
+    size_t len;
+    
+    PROF_ENTER(PROF_EXTRACT_XML_CONTENT);
+    
+    start_ptr = find_element(xml, tag, &end_ptr);
+    if (start_ptr == NULL) {
+        PROF_LEAVE(PROF_EXTRACT_XML_CONTENT);
+        return NULL;
+    }
+    start_ptr = skip_space(start_ptr, end_ptr);
+    
+    /* Allocate memory */
+    content = (char *)malloc(end_ptr - start_ptr + 1);
+    if (content == NULL) {
+        PROF_LEAVE(PROF_EXTRACT_XML_CONTENT);
+        return NULL;
+    }
+    
+    /* Copy, decode and trim */
+    len = decode_text(content, start_ptr, end_ptr);
+    content[len] = '\0';
+    
+    PROF_LEAVE(PROF_EXTRACT_XML_CONTENT);
+    
+    return content;
+}
+
+/**
+ * Trim and decode the text of an element in place, without copying it.
+ * Returns a pointer into xml and sets *len (the text is not NUL-terminated;
+ * the bytes freed by decoding are overwritten with spaces so the element
+ * stays well-formed). Elements after this one may no longer be found by
+ * their tags, so take the content last.
+ */
+char *take_xml_content(char *xml, const char *tag, size_t *len) {
+    char *start_ptr, *end_ptr;
+    
+    PROF_ENTER(PROF_TAKE_XML_CONTENT);
+    
+    start_ptr = find_element(xml, tag, &end_ptr);
+    if (start_ptr == NULL) {
+        PROF_LEAVE(PROF_TAKE_XML_CONTENT);
+        return NULL;
+    }
+    start_ptr = skip_space(start_ptr, end_ptr);
+    *len = decode_text(start_ptr, start_ptr, end_ptr);
+    memset(start_ptr + *len, ' ', end_ptr - (start_ptr + *len));
+    
+    PROF_LEAVE(PROF_TAKE_XML_CONTENT);
+    
+    return start_ptr;
+}
+
+/**
+ * Trim whitespace from beginning and end of string
+ */
+void trim_string(char *str) {
+    char *start = str;
+    char *end;
+    
+    PROF_ENTER(PROF_TRIM_STRING);
+    
+    /* Do nothing if string is empty */
+    if (str == NULL || *str == '\0') {
+        PROF_LEAVE(PROF_TRIM_STRING);
+        return;
+    }
+    
+    /* Skip leading whitespace */
+    while (*start && (*start == ' ' || *start == '\t' || *start == '\n' || *start == '\r')) {
+        start++;
+    }
+    
+    /* String is all whitespace */
+    if (*start == '\0') {
+        *str = '\0';
+        PROF_LEAVE(PROF_TRIM_STRING);
+        return;
+    }
+    
+    /* Find end of trailing whitespace */
+    end = start + strlen(start) - 1;
+    while (end > start && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) {
+        end--;
+    }
+    
+    /* Set null terminator */
+    *(end + 1) = '\0';
+    
+    /* Copy result back to original string (if needed) */
+    if (start != str) {
+        memmove(str, start, (end - start) + 2);
+    }
+    
+    PROF_LEAVE(PROF_TRIM_STRING);
+}
+
+/**
+ * Read one numeric field of the metadata
+ */
+static long meta_field(const char *xml, const char *tag) {
+    char *value = extract_xml_content(xml, tag);
+    long n = 0;
+    
+    if (value) {
+        n = atol(value);
+        free(value);
+    }
+    return n;
+}
+
+/**
+ * Parse the <meta> element of a response. Returns 1 if it was present.
+ */
+int parse_response_meta(const char *xml, struct response_meta *meta) {
+    char block[BUFFER_SIZE];
+    const char *start;
+    const char *end;
+    size_t len;
+    
+    start = strstr(xml, "<meta>");
+    if (start == NULL) {
+        return 0;
+    }
+    end = strstr(start, "</meta>");
+    if (end == NULL) {
+        return 0;
+    }
+    len = end - start;
+    if (len >= sizeof(block)) {
+        return 0;
+    }
+    memcpy(block, start, len);
+    block[len] = '\0';
+    
+    meta->queue_ms = meta_field(block, "queue_ms");
+    meta->ttft_ms = meta_field(block, "ttft_ms");
+    meta->upstream_ms = meta_field(block, "upstream_ms");
+    meta->total_ms = meta_field(block, "total_ms");
+    meta->prompt_tokens = meta_field(block, "prompt_tokens");
+    meta->completion_tokens = meta_field(block, "completion_tokens");
+    meta->cached_tokens = meta_field(block, "cached_tokens");
+    return 1;
+}
+
+/**
+ * Add a response's metadata to the totals and display it if enabled
+ */
+static void report_response_meta(const char *xml) {
+    struct response_meta meta;
+    long network_ms = -1;
+    
+    if (!parse_response_meta(xml, &meta)) {
+        return;
+    }
+    if (response_elapsed_ms >= 0 && response_elapsed_ms >= meta.total_ms) {
+        network_ms = response_elapsed_ms - meta.total_ms;
+    }
+    
+    meta_totals.responses++;
+    meta_totals.queue_ms += meta.queue_ms;
+    meta_totals.ttft_ms += meta.ttft_ms;
+    meta_totals.upstream_ms += meta.upstream_ms;
+    meta_totals.total_ms += meta.total_ms;
+    if (network_ms >= 0) {
+        meta_totals.timed++;
+        meta_totals.network_ms += network_ms;
+    }
+    if (meta.ttft_ms > meta_totals.max_ttft_ms) {
+        meta_totals.max_ttft_ms = meta.ttft_ms;
+    }
+    if (meta.total_ms > meta_totals.max_total_ms) {
+        meta_totals.max_total_ms = meta.total_ms;
+    }
+    meta_totals.prompt_tokens += meta.prompt_tokens;
+    meta_totals.completion_tokens += meta.completion_tokens;
+    meta_totals.cached_tokens += meta.cached_tokens;
+    
+    if (!show_meta) {
+        return;
+    }
+    render_printf("[Server: queue %ld ms, first token %ld ms, generation %ld ms, total %ld ms",
+                  meta.queue_ms, meta.ttft_ms, meta.upstream_ms, meta.total_ms);
+    if (network_ms >= 0) {
+        render_printf("; network %ld ms", network_ms);
+    }
+    render_printf("]\n[Tokens: prompt %ld (cached %ld), completion %ld]\n",
+                  meta.prompt_tokens, meta.cached_tokens, meta.completion_tokens);
+    if (trace_id[0] != '\0') {
+        render_printf("[Trace: %s]\n", trace_id);
+    }
+}
+
+/**
+ * Display the aggregated response metadata
+ */
+void show_meta_stats(void) {
+    double n = (double)meta_totals.responses;
+    
+    if (meta_totals.responses == 0) {
+        printf("Response timing: no data\n");
+        return;
+    }
+    printf("Response timing (%lu responses, average ms): queue %.0f, first token %.0f, "
+           "generation %.0f, server total %.0f",
+           meta_totals.responses, meta_totals.queue_ms / n, meta_totals.ttft_ms / n,
+           meta_totals.upstream_ms / n, meta_totals.total_ms / n);
+    if (meta_totals.timed > 0) {
+        printf(", network %.0f", meta_totals.network_ms / meta_totals.timed);
+    }
+    printf("\nSlowest (ms): first token %ld, server total %ld\n",
+           meta_totals.max_ttft_ms, meta_totals.max_total_ms);
+    printf("Tokens: prompt %.0f (cached %.0f, %.1f%%), completion %.0f\n",
+           meta_totals.prompt_tokens, meta_totals.cached_tokens,
+           meta_totals.prompt_tokens > 0 ?
+               meta_totals.cached_tokens * 100.0 / meta_totals.prompt_tokens : 0.0,
+           meta_totals.completion_tokens);
+}
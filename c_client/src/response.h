@@ -0,0 +1,75 @@
+/**
+ * Response buffering, parsing and rendering
+ *
+ * Kept apart from the connection handling in client.c so the parser can be
+ * linked into other programs (see bench/parser_bench.c).
+ */
+
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Constants */
+#define BUFFER_SIZE 4096
+#define DEFAULT_MEM_CAP 262144 /* Bytes kept in memory before spilling to disk */
+#define DEFAULT_SPILL_DIR "/tmp"
+#define MAX_PATH_SIZE 256
+
+/* Received response (in memory, or spilled to a temporary file) */
+struct response_buf {
+    char *data;   /* In-memory response, NUL-terminated (NULL once spilled) */
+    size_t size;  /* Bytes received */
+    FILE *spill;  /* Temporary file holding the response once over mem_cap */
+    int decoded;  /* <content> already decoded in place by process_response() */
+    size_t content_offset;  /* Decoded content span (valid if decoded) */
+    size_t content_len;
+};
+
+/* Server timing and token usage of one response (requested with @meta=1) */
+struct response_meta {
+    long queue_ms;       /* Server receive -> upstream request */
+    long ttft_ms;        /* Upstream request -> first token */
+    long upstream_ms;    /* Upstream request -> end of generation */
+    long total_ms;       /* Server receive -> reply built */
+    long prompt_tokens;
+    long completion_tokens;
+    long cached_tokens;
+};
+
+/* Metadata aggregated over all responses (shown by /stats) */
+struct meta_totals {
+    unsigned long responses;
+    double queue_ms, ttft_ms, upstream_ms, total_ms;
+    unsigned long timed;  /* Responses with a client-side round trip */
+    double network_ms;    /* Round trip minus server total */
+    long max_ttft_ms, max_total_ms;
+    double prompt_tokens, completion_tokens, cached_tokens;
+};
+
+/* Settings (CLIENT_MEM_CAP, CLIENT_SPILL_DIR, CLIENT_SHOW_META) */
+extern size_t mem_cap;
+extern char spill_dir[MAX_PATH_SIZE];
+extern int show_meta;
+
+/* Round trip of the last request as seen by the client (-1 if unknown) */
+extern long response_elapsed_ms;
+extern struct meta_totals meta_totals;
+
+/* Function prototypes */
+void response_reset(struct response_buf *response);
+int response_append(struct response_buf *response, const char *data, size_t len);
+size_t response_read(struct response_buf *response, size_t offset, char *buf, size_t len);
+int response_complete(struct response_buf *response);
+int stream_content(struct response_buf *response, FILE *out);
+void render_spilled_response(struct response_buf *response);
+int save_response(struct response_buf *response, const char *path);
+void process_response(struct response_buf *buf);
+char *extract_xml_content(const char *xml, const char *tag);
+char *take_xml_content(char *xml, const char *tag, size_t *len);
+int parse_response_meta(const char *xml, struct response_meta *meta);
+void show_meta_stats(void);
+void trim_string(char *str);
+
+#endif /* RESPONSE_H */
@@ -0,0 +1,128 @@
+/**
+ * Anonymized request trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+char trace_id[TRACE_ID_SIZE];
+
+static FILE *trace_file = NULL;
+static unsigned long trace_seq = 0;   /* Requests traced in this run */
+static char trace_run[16];            /* Tells runs apart in a shared file */
+
+/* Server commands recorded by name; anything else is "other" */
+static const char *trace_commands[] = {
+    "clear", "models", "model", "set", "stats", "session", "batch", NULL
+};
+
+/**
+ * Open the trace file for appending
+ */
+int trace_open(const char *path) {
+    trace_file = fopen(path, "a");
+    if (trace_file == NULL) {
+        perror(path);
+        return -1;
+    }
+    sprintf(trace_run, "%08lx",
+            ((unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16)) & 0xffffffffUL);
+    return 0;
+}
+
+/**
+ * Classify a request without recording its text
+ */
+static const char *trace_kind(const char *input) {
+    size_t len;
+    int i;
+    
+    if (input[0] != '/') {
+        return "chat";
+    }
+    input++;
+    len = strcspn(input, " ");
+    for (i = 0; trace_commands[i] != NULL; i++) {
+        if (strlen(trace_commands[i]) == len &&
+            strncmp(input, trace_commands[i], len) == 0) {
+            return trace_commands[i];
+        }
+    }
+    return "other";
+}
+
+/**
+ * Record one request
+ *
+ * think_ms is the time from showing the prompt to sending the request,
+ * latency_ms from sending it to the end of the response.
+ */
+void trace_request(const char *input, long think_ms, long latency_ms,
+                   size_t response_bytes, const char *status) {
+    if (trace_file == NULL) {
+        return;
+    }
+    
+    fprintf(trace_file,
+            "{\"run\":\"%s\",\"seq\":%lu,\"kind\":\"%s\",\"think_ms\":%ld,"
+            "\"prompt_bytes\":%lu,\"response_bytes\":%lu,\"latency_ms\":%ld,"
+            "\"status\":\"%s\",\"trace\":\"%s\"}\n",
+            trace_run, trace_seq, trace_kind(input), think_ms,
+            (unsigned long)strlen(input), (unsigned long)response_bytes,
+            latency_ms, status, trace_id);
+    fflush(trace_file);
+    trace_seq++;
+}
+
+/**
+ * Close the trace file
+ */
+void trace_close(void) {
+    if (trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+/**
+ * Generate the trace ID for the next chat request
+ *
+ * Random 128 bits in the W3C trace context format, so the ID can be passed
+ * on unchanged in the upstream traceparent header. Reads /dev/urandom and
+ * falls back to rand() (seeded in main) if it is unavailable.
+ */
+void trace_new_id(void) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[16];
+    FILE *random;
+    int zero = 1;
+    int i;
+    
+    random = fopen("/dev/urandom", "rb");
+    if (random == NULL || fread(bytes, 1, sizeof(bytes), random) != sizeof(bytes)) {
+        for (i = 0; i < 16; i++) {
+            bytes[i] = (unsigned char)(rand() & 0xff);
+        }
+    }
+    if (random != NULL) {
+        fclose(random);
+    }
+    
+    for (i = 0; i < 16; i++) {
+        if (bytes[i] != 0) {
+            zero = 0;
+        }
+        trace_id[i * 2] = hex[bytes[i] >> 4];
+        trace_id[i * 2 + 1] = hex[bytes[i] & 0x0f];
+    }
+    /* An all-zero ID is invalid in trace context */
+    if (zero) {
+        trace_id[31] = '1';
+    }
+    trace_id[32] = '\0';
+}
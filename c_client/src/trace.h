@@ -0,0 +1,28 @@
+/**
+ * Anonymized request trace (CLIENT_TRACE_FILE)
+ *
+ * One JSON line per request sent to the server with only the request kind,
+ * sizes and timings - never the text - so traces can be collected from real
+ * users to model the workload (see tools/loadReplay.ts).
+ *
+ * Chat requests also carry a trace ID (@trace=...) that the server stamps on
+ * its spans and forwards upstream, linking the three hops of one request.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+#define TRACE_ID_SIZE 33   /* 32 hex digits + terminator */
+
+/* Trace ID of the current chat request, empty for commands */
+extern char trace_id[TRACE_ID_SIZE];
+
+int trace_open(const char *path);
+void trace_request(const char *input, long think_ms, long latency_ms,
+                   size_t response_bytes, const char *status);
+void trace_close(void);
+void trace_new_id(void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,140 @@
+/**
+ * Response parser regression tests (make test)
+ *
+ * Each case parses a frame with process_response() (rendered output goes to
+ * /dev/null), saves it as /save does and compares the saved file with the
+ * expected text. Exits non-zero if any case fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "response.h"
+
+/* Test case */
+struct test_case {
+    const char *name;
+    const char *frame;
+    const char *saved;  /* Expected contents of the saved file */
+};
+
+static const struct test_case cases[] = {
+    {
+        "plain content",
+        "<response>\n  <model>m</model>\n  <content>Hello, world.</content>\n</response>\n\n",
+        "Hello, world."
+    },
+    {
+        "entities",
+        "<response>\n  <model>m</model>\n"
+        "  <content>if (a &lt; b &amp;&amp; c &gt; d) &#x41;&#66;</content>\n</response>\n\n",
+        "if (a < b && c > d) AB"
+    },
+    {
+        /* The decoded text contains a closing tag; /save must not stop there */
+        "escaped closing tag",
+        "<response>\n  <model>m</model>\n"
+        "  <content>Use &lt;/content&gt; to close the element.</content>\n</response>\n\n",
+        "Use </content> to close the element."
+    },
+    {
+        "batch results",
+        "<response>\n  <type>command</type>\n  <command>batch</command>\n"
+        "  <message>job-1</message>\n"
+        "  <content>### a\n&lt;/content&gt; done</content>\n</response>\n\n",
+        "### a\n</content> done"
+    }
+};
+
+/**
+ * Read a whole file into a NUL-terminated buffer
+ */
+static char *read_file(const char *path) {
+    FILE *in;
+    char *data;
+    long size;
+    
+    in = fopen(path, "rb");
+    if (in == NULL) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    rewind(in);
+    data = malloc(size + 1);
+    if (data != NULL) {
+        size = (long)fread(data, 1, size, in);
+        data[size] = '\0';
+    }
+    fclose(in);
+    return data;
+}
+
+/**
+ * Parse and save one frame. Returns 0 if the saved text matches.
+ */
+static int run_case(const struct test_case *c, const char *path) {
+    struct response_buf buf = { NULL, 0, NULL, 0, 0, 0 };
+    char *saved;
+    int failed;
+    
+    if (response_append(&buf, c->frame, strlen(c->frame)) < 0) {
+        return 1;
+    }
+    process_response(&buf);
+    if (save_response(&buf, path) < 0) {
+        response_reset(&buf);
+        return 1;
+    }
+    response_reset(&buf);
+    
+    saved = read_file(path);
+    failed = saved == NULL || strcmp(saved, c->saved) != 0;
+    if (failed) {
+        fprintf(stderr, "  expected: \"%s\"\n  saved:    \"%s\"\n",
+                c->saved, saved ? saved : "(none)");
+    }
+    free(saved);
+    return failed;
+}
+
+int main(void) {
+    char path[] = "/tmp/response_testXXXXXX";
+    int stdout_fd;
+    int null_fd;
+    int fd;
+    int failed;
+    int failures = 0;
+    size_t i;
+    
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    
+    /* Keep the report on the original stdout */
+    fflush(stdout);
+    stdout_fd = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+        }
+        failed = run_case(&cases[i], path);
+        fflush(stdout);
+        dup2(stdout_fd, STDOUT_FILENO);
+        printf("%-24s %s\n", cases[i].name, failed ? "FAIL" : "ok");
+        fflush(stdout);
+        failures += failed;
+    }
+    
+    unlink(path);
+    printf("%d failed\n", failures);
+    return failures > 0;
+}
@@ -0,0 +1,311 @@
+import * as fs from "node:fs";
+import * as http from "node:http";
+import * as https from "node:https";
+import OpenAI, { type ClientOptions } from "openai";
+import { logger } from "./logger";
+import { traceFetch } from "./upstreamTrace";
+
+// 上流APIのバックエンド管理
+//
+// モデル名ごとに送信先（OpenAI または LAN 内の OpenAI 互換サーバー）を決める。
+// バックエンドごとに接続プール（keep-alive のエージェント）、同時実行数の上限、
+// ヘルスチェックを持つ。同じモデルを複数のバックエンドが提供する場合は、
+// 正常なものの中から空きの多いものを選ぶ。
+//
+// 設定は BACKENDS_FILE の JSON で指定する（未指定の場合は OpenAI のみ）:
+//   [{ "name": "local", "baseURL": "http://10.0.0.5:8000/v1",
+//      "models": ["llama-3.1-8b"], "maxConcurrency": 4 }, ...]
+
+// 環境変数からの設定取得
+const BACKENDS_FILE = process.env.BACKENDS_FILE || "";
+const HEALTH_INTERVAL_MS = Number.parseInt(
+  process.env.BACKEND_HEALTH_INTERVAL_MS || (BACKENDS_FILE ? "10000" : "0"),
+  10
+); // ヘルスチェックの間隔（0の場合は行わない。BACKENDS_FILE がない場合は既定で行わない）
+const HEALTH_TIMEOUT_MS = Number.parseInt(
+  process.env.BACKEND_HEALTH_TIMEOUT_MS || "3000",
+  10
+);
+
+// 設定を省略した場合のモデル（OpenAI）
+const OPENAI_MODELS = [
+  "gpt-4.1-2025-04-14",
+  "gpt-4.1-nano-2025-04-14",
+  "o4-mini-2025-04-16",
+];
+
+// バックエンドの設定
+export interface BackendConfig {
+  name: string;
+  baseURL?: string; // 省略時は OpenAI（OPENAI_BASE_URL があればそれ）
+  apiKey?: string; // 省略時は OPENAI_API_KEY（ローカルサーバーでは任意の文字列）
+  apiKeyEnv?: string; // APIキーを読む環境変数名
+  models?: string[]; // 省略時はヘルスチェックの /models の結果を使う
+  maxConcurrency?: number; // 同時に送るリクエスト数の上限（0の場合は制限しない）
+  maxSockets?: number; // 接続プールの最大接続数
+  timeoutMs?: number; // リクエストのタイムアウト
+  maxRetries?: number; // SDKの再試行回数
+}
+
+// 確保したバックエンド（応答を受け終えたら release する）
+export interface Lease {
+  backend: string;
+  client: OpenAI;
+  release(error?: unknown): void;
+}
+
+// 1バックエンド分の状態
+class Backend {
+  readonly client: OpenAI;
+  readonly models = new Set<string>();
+  private readonly agent: http.Agent;
+  private readonly waiters: (() => void)[] = [];
+  inFlight = 0;
+  healthy = true;
+  private requests = 0;
+  private errors = 0;
+  private queued = 0;
+  private lastCheckMs = -1;
+
+  constructor(readonly config: BackendConfig) {
+    const baseURL = config.baseURL || process.env.OPENAI_BASE_URL;
+    const secure = !baseURL || baseURL.startsWith("https:");
+    const agentOptions = {
+      keepAlive: true,
+      maxSockets: config.maxSockets || Number.POSITIVE_INFINITY,
+    };
+    this.agent = secure
+      ? new https.Agent(agentOptions)
+      : new http.Agent(agentOptions);
+    const tracedFetch = traceFetch() as unknown as ClientOptions["fetch"];
+    this.client = new OpenAI({
+      apiKey:
+        config.apiKey ||
+        (config.apiKeyEnv ? process.env[config.apiKeyEnv] : undefined) ||
+        process.env.OPENAI_API_KEY ||
+        (config.baseURL ? "local" : undefined),
+      baseURL: config.baseURL,
+      httpAgent: this.agent,
+      // 上流の通信を記録・再生する場合だけ fetch を差し替える
+      // （記録時も httpAgent の接続プールを使う）
+      ...(tracedFetch ? { fetch: tracedFetch } : {}),
+      timeout: config.timeoutMs,
+      maxRetries: config.maxRetries,
+    });
+    for (const model of config.models || []) {
+      this.models.add(model);
+    }
+  }
+
+  get name(): string {
+    return this.config.name;
+  }
+
+  // 空き具合（小さいほど空いている）
+  get load(): number {
+    const limit = this.config.maxConcurrency || 0;
+    return limit > 0 ? (this.inFlight + this.waiters.length) / limit : 0;
+  }
+
+  // 同時実行数の枠を確保する（上限に達していれば空くまで待つ）
+  async acquire(): Promise<Lease> {
+    const limit = this.config.maxConcurrency || 0;
+    if (limit > 0 && this.inFlight >= limit) {
+      // 枠は解放した側からそのまま引き継ぐ（inFlight は増やさない）
+      this.queued++;
+      await new Promise<void>((resolve) => this.waiters.push(resolve));
+    } else {
+      this.inFlight++;
+    }
+    this.requests++;
+
+    let released = false;
+    return {
+      backend: this.name,
+      client: this.client,
+      release: (error?: unknown) => {
+        if (released) {
+          return;
+        }
+        released = true;
+        if (error !== undefined) {
+          this.errors++;
+          // 接続できない場合は次のヘルスチェックまで選択しない
+          if (error instanceof OpenAI.APIConnectionError) {
+            this.healthy = false;
+          }
+        }
+        const next = this.waiters.shift();
+        if (next) {
+          next();
+        } else {
+          this.inFlight--;
+        }
+      },
+    };
+  }
+
+  // ヘルスチェック（/models を取得し、モデル一覧が未設定なら取り込む）
+  async check(): Promise<void> {
+    const startedAt = Date.now();
+    try {
+      const list = await this.client.models.list({
+        timeout: HEALTH_TIMEOUT_MS,
+        maxRetries: 0,
+      });
+      if (!this.config.models) {
+        for (const model of list.data) {
+          this.models.add(model.id);
+        }
+      }
+      if (!this.healthy) {
+        logger.info("backend", "バックエンド復旧", { backend: this.name });
+      }
+      this.healthy = true;
+    } catch (error) {
+      if (this.healthy) {
+        logger.warn("backend", "バックエンド異常", {
+          backend: this.name,
+          error,
+        });
+      }
+      this.healthy = false;
+    }
+    this.lastCheckMs = Date.now() - startedAt;
+  }
+
+  // 統計情報
+  stats(): Record<string, number> {
+    return {
+      healthy: this.healthy ? 1 : 0,
+      models: this.models.size,
+      in_flight: this.inFlight,
+      waiting: this.waiters.length,
+      max_concurrency: this.config.maxConcurrency || 0,
+      requests: this.requests,
+      queued: this.queued,
+      errors: this.errors,
+      health_check_ms: this.lastCheckMs,
+    };
+  }
+
+  close(): void {
+    this.agent.destroy();
+  }
+}
+
+export class BackendRegistry {
+  private readonly backends: Backend[];
+  private timer: NodeJS.Timeout | null = null;
+
+  constructor(configs: BackendConfig[]) {
+    this.backends = configs.map((config) => new Backend(config));
+  }
+
+  // 環境変数の設定から作成
+  static fromEnv(): BackendRegistry {
+    if (!BACKENDS_FILE) {
+      return new BackendRegistry([{ name: "openai", models: OPENAI_MODELS }]);
+    }
+    const configs = JSON.parse(
+      fs.readFileSync(BACKENDS_FILE, "utf-8")
+    ) as BackendConfig[];
+    if (!Array.isArray(configs) || configs.length === 0) {
+      throw new Error(`${BACKENDS_FILE}: バックエンドが定義されていません`);
+    }
+    return new BackendRegistry(configs);
+  }
+
+  // ヘルスチェックを開始（初回は完了まで待ち、モデル一覧を確定させる）
+  async start(): Promise<void> {
+    const needsModels = this.backends.some((backend) => !backend.config.models);
+    if (HEALTH_INTERVAL_MS <= 0 && !needsModels) {
+      return;
+    }
+    await this.checkAll();
+    if (HEALTH_INTERVAL_MS > 0) {
+      this.timer = setInterval(() => {
+        this.checkAll();
+      }, HEALTH_INTERVAL_MS);
+      this.timer.unref();
+    }
+  }
+
+  stop(): void {
+    if (this.timer) {
+      clearInterval(this.timer);
+      this.timer = null;
+    }
+    for (const backend of this.backends) {
+      backend.close();
+    }
+  }
+
+  // 利用可能なモデル（設定順、重複なし）
+  models(): string[] {
+    const models = new Set<string>();
+    for (const backend of this.backends) {
+      for (const model of backend.models) {
+        models.add(model);
+      }
+    }
+    return [...models];
+  }
+
+  has(model: string): boolean {
+    return this.backends.some((backend) => backend.models.has(model));
+  }
+
+  // モデルを提供するバックエンドを選んで枠を確保する
+  // 正常なものを優先し、その中で空いているものを選ぶ
+  acquire(model: string): Promise<Lease> {
+    const selected = this.select(model);
+    if (!selected) {
+      return Promise.reject(
+        new Error(`モデル '${model}' を提供するバックエンドがありません`)
+      );
+    }
+    return selected.acquire();
+  }
+
+  // モデルを提供するバックエンドのクライアント（バッチ処理など、同時実行数の
+  // 枠を使わない呼び出し用）
+  clientFor(model: string): OpenAI {
+    const selected = this.select(model);
+    if (!selected) {
+      throw new Error(`モデル '${model}' を提供するバックエンドがありません`);
+    }
+    return selected.client;
+  }
+
+  // 統計情報
+  stats(): Record<string, Record<string, number>> {
+    const result: Record<string, Record<string, number>> = {};
+    for (const backend of this.backends) {
+      result[backend.name] = backend.stats();
+    }
+    return result;
+  }
+
+  // モデルを提供するバックエンドの選択
+  private select(model: string): Backend | undefined {
+    let selected: Backend | undefined;
+    for (const backend of this.backends) {
+      if (!backend.models.has(model)) {
+        continue;
+      }
+      if (
+        !selected ||
+        (backend.healthy && !selected.healthy) ||
+        (backend.healthy === selected.healthy && backend.load < selected.load)
+      ) {
+        selected = backend;
+      }
+    }
+    return selected;
+  }
+
+  private async checkAll(): Promise<void> {
+    await Promise.all(this.backends.map((backend) => backend.check()));
+  }
+}
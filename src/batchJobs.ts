@@ -0,0 +1,387 @@
+import { randomBytes } from "node:crypto";
+import * as fs from "node:fs";
+import * as path from "node:path";
+import type OpenAI from "openai";
+import { toFile } from "openai";
+import { logger } from "./logger";
+
+// 上流APIのバッチ処理によるオフラインの一括実行
+//
+// 夜間の評価のように即時の応答が不要なプロンプトの一覧を、対話用の経路
+// （1件ずつの送信、同時実行数とレート制限の枠）を通さずに、上流の非同期
+// バッチAPI（/v1/files と /v1/batches）へまとめて送る。完了までポーリングし、
+// 結果は BATCH_RESULT_DIR に JSONL で書き出して /batch results で返す。
+//
+// ジョブIDは推測できない乱数（128ビット）で、IDを知っていればどのセッションからでも
+// 状態・結果の確認と取り消しができる（クライアントを再起動してセッションが変わっても、
+// 夜間のジョブの結果を取得できるようにするため）。一覧は登録したセッションのもののみ。
+// 終了したジョブは BATCH_RETENTION_MS の経過後に一覧から削除する（結果ファイルは残す）。
+//
+// プロンプトファイルは1行1件。{ で始まる行は JSON として
+// { "custom_id": "...", "prompt": "..." } または { "messages": [...] } を受け付ける。
+
+// 環境変数からの設定取得
+const POLL_INTERVAL_MS = Number.parseInt(
+  process.env.BATCH_POLL_INTERVAL_MS || "30000",
+  10
+); // 上流のジョブ状態を確認する間隔
+export const BATCH_MAX_PROMPTS = Number.parseInt(
+  process.env.BATCH_MAX_PROMPTS || "50000",
+  10
+); // 1ジョブのプロンプト数の上限
+const RESULT_DIR = process.env.BATCH_RESULT_DIR || "batch_results"; // 結果の書き出し先
+const RETENTION_MS = Number.parseInt(
+  process.env.BATCH_RETENTION_MS || "604800000",
+  10
+); // 終了したジョブを保持する期間
+const COMPLETION_WINDOW = "24h";
+
+// 上流のジョブの終了状態
+const TERMINAL_STATUSES = ["completed", "failed", "expired", "cancelled"];
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// 1件分のリクエスト
+export interface BatchPrompt {
+  custom_id: string;
+  prompt: string; // 結果の表示用（messages 指定の場合は最後のユーザーメッセージ）
+  messages: { role: string; content: string }[];
+}
+
+// 1件分の結果（結果ファイルの1行）
+interface BatchResult {
+  custom_id: string;
+  prompt: string;
+  content: string | null;
+  error: string | null;
+  prompt_tokens: number;
+  completion_tokens: number;
+}
+
+// ジョブの状態
+export interface BatchJob {
+  id: string;
+  name: string;
+  session: string;
+  model: string;
+  status: string; // submitting → 上流の状態（validating, in_progress, ...）または error
+  upstreamId: string | null;
+  total: number;
+  completed: number;
+  failed: number;
+  promptTokens: number;
+  completionTokens: number;
+  createdAt: number;
+  finishedAt: number | null;
+  resultPath: string | null;
+  error: string | null;
+}
+
+// 送信時の指定
+export interface BatchSubmission {
+  session: string;
+  name: string;
+  model: string;
+  system: string; // 各リクエストの先頭に付けるシステムプロンプト
+  params: Record<string, unknown>; // max_completion_tokens などの生成パラメーター
+  prompts: BatchPrompt[];
+}
+
+// プロンプトファイルの解析（空行は無視し、custom_id は重複しないようにする）
+export function parsePromptFile(lines: string[]): BatchPrompt[] {
+  const prompts: BatchPrompt[] = [];
+  const ids = new Set<string>();
+  lines.forEach((line, index) => {
+    const text = line.trim();
+    if (!text) {
+      return;
+    }
+    let customId = `line-${index + 1}`;
+    let prompt = text;
+    let messages: { role: string; content: string }[] | null = null;
+    if (text.startsWith("{")) {
+      const item = JSON.parse(text);
+      if (typeof item.custom_id === "string" && item.custom_id) {
+        customId = item.custom_id;
+      }
+      if (Array.isArray(item.messages)) {
+        messages = item.messages;
+        const user = [...item.messages]
+          .reverse()
+          .find((m: { role: string }) => m.role === "user");
+        prompt = user ? String(user.content) : "";
+      } else if (typeof item.prompt === "string") {
+        prompt = item.prompt;
+      } else {
+        throw new Error(`${index + 1}行目: prompt または messages がありません`);
+      }
+    }
+    if (ids.has(customId)) {
+      customId = `${customId}-${index + 1}`;
+    }
+    ids.add(customId);
+    prompts.push({
+      custom_id: customId,
+      prompt,
+      messages: messages || [{ role: "user", content: prompt }],
+    });
+  });
+  return prompts;
+}
+
+export class BatchJobs {
+  private readonly jobs = new Map<string, BatchJob>();
+
+  constructor(private readonly clientFor: (model: string) => OpenAI) {}
+
+  // ジョブを登録して上流への送信を開始する
+  submit(submission: BatchSubmission): BatchJob {
+    this.evictFinished();
+    const job: BatchJob = {
+      id: `batch_${randomBytes(16).toString("hex")}`,
+      name: submission.name,
+      session: submission.session,
+      model: submission.model,
+      status: "submitting",
+      upstreamId: null,
+      total: submission.prompts.length,
+      completed: 0,
+      failed: 0,
+      promptTokens: 0,
+      completionTokens: 0,
+      createdAt: Date.now(),
+      finishedAt: null,
+      resultPath: null,
+      error: null,
+    };
+    this.jobs.set(job.id, job);
+
+    this.run(job, submission).catch((error) => {
+      job.status = "error";
+      job.error = error instanceof Error ? error.message : String(error);
+      job.finishedAt = Date.now();
+      logger.error("batch", "バッチジョブ失敗", {
+        job: job.id,
+        session: job.session,
+        error: job.error,
+      });
+    });
+    return job;
+  }
+
+  // IDでジョブを取得（IDを知っていればどのセッションからでも参照できる）
+  get(id: string): BatchJob | undefined {
+    this.evictFinished();
+    return this.jobs.get(id);
+  }
+
+  // セッションのジョブ（新しい順）
+  list(session: string): BatchJob[] {
+    this.evictFinished();
+    return [...this.jobs.values()]
+      .filter((job) => job.session === session)
+      .reverse();
+  }
+
+  // 上流のジョブを取り消す（結果は取り消しまでに完了した分のみ）
+  async cancel(id: string): Promise<BatchJob> {
+    const job = this.require(id);
+    if (!job.upstreamId || isFinished(job)) {
+      throw new Error(`${id} は取り消せません（状態: ${job.status}）`);
+    }
+    await this.clientFor(job.model).batches.cancel(job.upstreamId);
+    job.status = "cancelling";
+    return job;
+  }
+
+  // 結果を表示用のテキストとして返す
+  async results(id: string): Promise<string> {
+    const job = this.require(id);
+    if (!job.resultPath) {
+      throw new Error(`${id} の結果はまだありません（状態: ${job.status}）`);
+    }
+    const text = await fs.promises.readFile(job.resultPath, "utf-8");
+    const blocks = [formatJob(job)];
+    for (const line of text.split("\n")) {
+      if (!line) {
+        continue;
+      }
+      const result = JSON.parse(line) as BatchResult;
+      blocks.push(
+        `### ${result.custom_id}\n> ${result.prompt}\n${
+          result.error === null ? result.content : `エラー: ${result.error}`
+        }`
+      );
+    }
+    return blocks.join("\n\n");
+  }
+
+  // 統計情報
+  stats(): Record<string, number> {
+    this.evictFinished();
+    let running = 0;
+    let prompts = 0;
+    for (const job of this.jobs.values()) {
+      if (!isFinished(job)) {
+        running++;
+      }
+      prompts += job.total;
+    }
+    return { jobs: this.jobs.size, running, prompts };
+  }
+
+  private require(id: string): BatchJob {
+    const job = this.get(id);
+    if (!job) {
+      throw new Error(`${id} というジョブはありません`);
+    }
+    return job;
+  }
+
+  // 保持期間を過ぎた終了済みのジョブを削除
+  private evictFinished(): void {
+    const now = Date.now();
+    for (const [id, job] of this.jobs) {
+      if (isFinished(job) && now - (job.finishedAt as number) > RETENTION_MS) {
+        this.jobs.delete(id);
+      }
+    }
+  }
+
+  // 入力ファイルのアップロード → ジョブ作成 → ポーリング → 結果の取得
+  private async run(job: BatchJob, submission: BatchSubmission): Promise<void> {
+    const client = this.clientFor(job.model);
+    const input = submission.prompts
+      .map((prompt) =>
+        JSON.stringify({
+          custom_id: prompt.custom_id,
+          method: "POST",
+          url: "/v1/chat/completions",
+          body: {
+            model: job.model,
+            messages:
+              prompt.messages[0]?.role === "system"
+                ? prompt.messages
+                : [
+                    { role: "system", content: submission.system },
+                    ...prompt.messages,
+                  ],
+            ...submission.params,
+          },
+        })
+      )
+      .join("\n");
+    const file = await client.files.create({
+      file: await toFile(Buffer.from(`${input}\n`), `${job.id}.jsonl`),
+      purpose: "batch",
+    });
+    let batch = await client.batches.create({
+      input_file_id: file.id,
+      endpoint: "/v1/chat/completions",
+      completion_window: COMPLETION_WINDOW,
+      metadata: { job: job.id, name: job.name },
+    });
+    job.upstreamId = batch.id;
+    logger.info("batch", "バッチジョブ送信", {
+      job: job.id,
+      session: job.session,
+      upstream: batch.id,
+      prompts: job.total,
+    });
+
+    for (;;) {
+      job.status = batch.status;
+      job.completed = batch.request_counts?.completed || 0;
+      job.failed = batch.request_counts?.failed || 0;
+      if (TERMINAL_STATUSES.includes(batch.status)) {
+        break;
+      }
+      await sleep(POLL_INTERVAL_MS);
+      batch = await client.batches.retrieve(batch.id);
+    }
+
+    // 成功分と失敗分のファイルを取得し、プロンプトの順に並べて書き出す
+    const outputs = new Map<string, BatchResult>();
+    for (const fileId of [batch.output_file_id, batch.error_file_id]) {
+      if (!fileId) {
+        continue;
+      }
+      const text = await (await client.files.content(fileId)).text();
+      for (const line of text.split("\n")) {
+        if (line.trim()) {
+          const result = parseOutputLine(line);
+          outputs.set(result.custom_id, result);
+        }
+      }
+    }
+    const lines: string[] = [];
+    for (const prompt of submission.prompts) {
+      const result = outputs.get(prompt.custom_id) || {
+        custom_id: prompt.custom_id,
+        prompt: "",
+        content: null,
+        error: `処理されませんでした（${batch.status}）`,
+        prompt_tokens: 0,
+        completion_tokens: 0,
+      };
+      result.prompt = prompt.prompt;
+      job.promptTokens += result.prompt_tokens;
+      job.completionTokens += result.completion_tokens;
+      lines.push(JSON.stringify(result));
+    }
+
+    await fs.promises.mkdir(RESULT_DIR, { recursive: true });
+    const resultPath = path.join(RESULT_DIR, `${job.id}.jsonl`);
+    await fs.promises.writeFile(resultPath, `${lines.join("\n")}\n`);
+    job.resultPath = resultPath;
+    job.finishedAt = Date.now();
+    logger.info("batch", "バッチジョブ完了", {
+      job: job.id,
+      session: job.session,
+      status: batch.status,
+      path: resultPath,
+    });
+  }
+}
+
+// 上流の出力ファイルの1行を結果に変換
+function parseOutputLine(line: string): BatchResult {
+  const item = JSON.parse(line);
+  const body = item.response?.body;
+  const status = item.response?.status_code;
+  let error: string | null = null;
+  if (item.error) {
+    error = item.error.message || JSON.stringify(item.error);
+  } else if (status !== 200) {
+    error = body?.error?.message || `HTTP ${status}`;
+  }
+  return {
+    custom_id: item.custom_id,
+    prompt: "",
+    content: error === null ? body?.choices?.[0]?.message?.content || "" : null,
+    error,
+    prompt_tokens: body?.usage?.prompt_tokens || 0,
+    completion_tokens: body?.usage?.completion_tokens || 0,
+  };
+}
+
+function isFinished(job: BatchJob): boolean {
+  return job.finishedAt !== null;
+}
+
+// ジョブの状態の表示用テキスト
+export function formatJob(job: BatchJob): string {
+  const fields = [
+    job.id,
+    job.name ? `'${job.name}'` : "",
+    job.status,
+    `${job.completed}/${job.total}`,
+    job.failed ? `failed=${job.failed}` : "",
+    `model=${job.model}`,
+    job.finishedAt
+      ? `tokens=${job.promptTokens}+${job.completionTokens}`
+      : `elapsed=${Math.round((Date.now() - job.createdAt) / 1000)}s`,
+    job.error ? `error=${job.error}` : "",
+  ];
+  return fields.filter((field) => field).join(" ");
+}
@@ -0,0 +1,173 @@
+// セッションごとの生成パラメーター（/set コマンド）
+//
+//   /set                       現在の設定を表示
+//   /set max_tokens 500        出力トークン数の上限
+//   /set reasoning low         推論モデルの推論量（low / medium / high）
+//   /set temperature 0.7       温度（0〜2、推論モデルでは無視）
+//   /set <名前> default        既定値に戻す
+//
+// 出力トークン数は、未設定の場合はサーバーの既定値を使い、設定した場合も
+// サーバーの上限を超えないように切り詰める。
+
+// 環境変数からの設定取得
+const DEFAULT_MAX_OUTPUT_TOKENS = Number.parseInt(
+  process.env.DEFAULT_MAX_OUTPUT_TOKENS || "0",
+  10
+); // 未設定のセッションに適用する上限（0の場合は指定しない）
+const MAX_OUTPUT_TOKENS_LIMIT = Number.parseInt(
+  process.env.MAX_OUTPUT_TOKENS_LIMIT || "0",
+  10
+); // セッションが設定できる上限（0の場合は制限しない）
+
+// 推論量の選択肢
+const REASONING_EFFORTS = ["low", "medium", "high"] as const;
+type ReasoningEffort = (typeof REASONING_EFFORTS)[number];
+
+// セッションの設定（未設定の項目は既定値）
+export interface GenerationSettings {
+  max_tokens?: number;
+  reasoning?: ReasoningEffort;
+  temperature?: number;
+}
+
+// 上流APIへのリクエストに加えるパラメーター
+export interface GenerationParams {
+  max_completion_tokens?: number;
+  reasoning_effort?: ReasoningEffort;
+  temperature?: number;
+}
+
+// /set の結果
+export interface SetResult {
+  success: boolean;
+  settings: GenerationSettings;
+  message: string;
+}
+
+// 推論モデル（temperature を受け付けず、reasoning_effort を受け付ける）
+export function isReasoningModel(model: string): boolean {
+  return /^o\d/.test(model);
+}
+
+// 実際に使う出力トークン数の上限（0の場合は指定しない）
+function effectiveMaxTokens(settings: GenerationSettings): number {
+  const requested = settings.max_tokens || DEFAULT_MAX_OUTPUT_TOKENS;
+  if (MAX_OUTPUT_TOKENS_LIMIT > 0) {
+    return requested > 0
+      ? Math.min(requested, MAX_OUTPUT_TOKENS_LIMIT)
+      : MAX_OUTPUT_TOKENS_LIMIT;
+  }
+  return requested;
+}
+
+// 上流APIへのリクエストに加えるパラメーター
+export function generationParams(
+  model: string,
+  settings: GenerationSettings
+): GenerationParams {
+  const params: GenerationParams = {};
+  const maxTokens = effectiveMaxTokens(settings);
+  if (maxTokens > 0) {
+    params.max_completion_tokens = maxTokens;
+  }
+  if (isReasoningModel(model)) {
+    if (settings.reasoning) {
+      params.reasoning_effort = settings.reasoning;
+    }
+  } else if (settings.temperature !== undefined) {
+    params.temperature = settings.temperature;
+  }
+  return params;
+}
+
+// 設定の表示用テキスト
+export function formatSettings(settings: GenerationSettings): string {
+  const maxTokens = effectiveMaxTokens(settings);
+  return [
+    `max_tokens=${maxTokens > 0 ? maxTokens : "none"}${
+      settings.max_tokens ? "" : " (default)"
+    }`,
+    `reasoning=${settings.reasoning || "default"}`,
+    `temperature=${
+      settings.temperature !== undefined ? settings.temperature : "default"
+    }`,
+  ].join(" ");
+}
+
+// /set の引数を解釈して新しい設定を返す
+export function applySetCommand(
+  args: string,
+  current: GenerationSettings
+): SetResult {
+  const [name, value] = args.trim().split(/\s+/);
+  const settings: GenerationSettings = { ...current };
+
+  if (!name) {
+    return {
+      success: true,
+      settings,
+      message: `現在の設定: ${formatSettings(settings)}`,
+    };
+  }
+
+  const fail = (message: string): SetResult => ({
+    success: false,
+    settings: current,
+    message: `エラー: ${message}`,
+  });
+
+  if (value === undefined) {
+    return fail(`${name} の値を指定してください。`);
+  }
+
+  const reset = value.toLowerCase() === "default";
+  switch (name.toLowerCase()) {
+    case "max_tokens": {
+      const n = Number(value);
+      if (reset) {
+        settings.max_tokens = undefined;
+      } else if (Number.isInteger(n) && n > 0) {
+        settings.max_tokens = n;
+      } else {
+        return fail("max_tokens は正の整数で指定してください。");
+      }
+      break;
+    }
+    case "reasoning": {
+      const effort = value.toLowerCase() as ReasoningEffort;
+      if (reset) {
+        settings.reasoning = undefined;
+      } else if (REASONING_EFFORTS.includes(effort)) {
+        settings.reasoning = effort;
+      } else {
+        return fail(`reasoning は ${REASONING_EFFORTS.join(" / ")} のいずれかです。`);
+      }
+      break;
+    }
+    case "temperature": {
+      const t = Number(value);
+      if (reset) {
+        settings.temperature = undefined;
+      } else if (Number.isFinite(t) && t >= 0 && t <= 2) {
+        settings.temperature = t;
+      } else {
+        return fail("temperature は 0〜2 の数値で指定してください。");
+      }
+      break;
+    }
+    default:
+      return fail(
+        `'${name}' は不明な設定です。max_tokens / reasoning / temperature を指定できます。`
+      );
+  }
+
+  let message = `設定を変更しました: ${formatSettings(settings)}`;
+  if (
+    settings.max_tokens &&
+    MAX_OUTPUT_TOKENS_LIMIT > 0 &&
+    settings.max_tokens > MAX_OUTPUT_TOKENS_LIMIT
+  ) {
+    message += `（サーバーの上限 ${MAX_OUTPUT_TOKENS_LIMIT} に制限されます）`;
+  }
+  return { success: true, settings, message };
+}
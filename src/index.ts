@@ -1,8 +1,44 @@
 import * as net from "node:net";
 import { config } from "dotenv";
-import OpenAI from "openai";
-import type { ChatCompletionMessageParam } from "openai/resources/chat/completions";
-import { XMLBuilder } from "fast-xml-parser";
+import type {
+  ChatCompletionCreateParamsStreaming,
+  ChatCompletionMessageParam,
+} from "openai/resources/chat/completions";
+import { BackendRegistry, type Lease } from "./backends";
+import {
+  BATCH_MAX_PROMPTS,
+  BatchJobs,
+  formatJob,
+  parsePromptFile,
+} from "./batchJobs";
+import {
+  type GenerationSettings,
+  applySetCommand,
+  generationParams,
+} from "./generationSettings";
+import { logger, truncate } from "./logger";
+import {
+  DEFAULT_FORMAT,
+  type FrameFormat,
+  formatName,
+  parseEncodingName,
+} from "./outputEncoding";
+import { Profiler, isAdmin } from "./profiler";
+import { parseRequestLine } from "./protocol";
+import { RateLimiter, estimateTokens } from "./rateBudget";
+import { ReplayStore } from "./replayStore";
+import { RequestTrace, type Span, requestTraceStats } from "./requestTrace";
+import {
+  ReplicationPrimary,
+  ReplicationStandby,
+  type SessionMutation,
+  type SessionSnapshot,
+  parseHostPort,
+} from "./replication";
+import { buildRequestBody, encodeMessageSegment } from "./requestBody";
+import { OFFLOAD_THRESHOLD, buildResponseFrame } from "./serializer";
+import { traceStats } from "./upstreamTrace";
+import { type UsageLike, UsageStats } from "./usageStats";
 
 // 環境変数の読み込み
 config();
@@ -11,55 +47,288 @@ config();
 const PORT = Number.parseInt(process.env.PORT || "3000", 10);
 const HOST = process.env.HOST || "0.0.0.0"; // Dockerコンテナ内では0.0.0.0にバインドして外部からアクセス可能にする
 const MAX_HISTORY = 10; // 保持する会話履歴の最大数
+const HISTORY_EVICT_BLOCK = Math.max(
+  1,
+  Number.parseInt(process.env.HISTORY_EVICT_BLOCK || "6", 10) || 1
+); // 履歴が上限を超えたときにまとめて削除するメッセージ数
+const IDEMPOTENCY_RETENTION_MS = Number.parseInt(
+  process.env.IDEMPOTENCY_RETENTION_MS || "300000",
+  10
+); // 冪等キー付きレスポンスの保持期間
+const IDEMPOTENCY_MAX_BYTES = Number.parseInt(
+  process.env.IDEMPOTENCY_MAX_BYTES || String(64 * 1024 * 1024),
+  10
+); // 保持するレスポンスの合計サイズ上限
+const SESSION_RETENTION_MS = Number.parseInt(
+  process.env.SESSION_RETENTION_MS || "1800000",
+  10
+); // 名前付きセッションを切断後に保持する期間
+const REPLICATION_TARGET = process.env.REPLICATION_TARGET || ""; // スタンバイの host:port
+const REPLICATION_LISTEN = process.env.REPLICATION_LISTEN || ""; // スタンバイとして受信する [host:]port
+const REPLICATION_ROLE = process.env.REPLICATION_ROLE || ""; // primary または standby
 
-// 利用可能なモデルの定義
-const AVAILABLE_MODELS = [
-  "gpt-4.1-2025-04-14",
-  "gpt-4.1-nano-2025-04-14",
-  "o4-mini-2025-04-16",
-];
+// セッションIDの形式
+const SESSION_ID_PATTERN = /^[A-Za-z0-9_-]{1,64}$/;
 
-const DEFAULT_MODEL = "gpt-4.1-nano-2025-04-14";
+const DEFAULT_MODEL = process.env.DEFAULT_MODEL || "gpt-4.1-nano-2025-04-14";
+const SYSTEM_PROMPT = "あなたは役立つアシスタントです。";
 
-// OpenAI APIクライアントの初期化
-const openai = new OpenAI({
-  apiKey: process.env.OPENAI_API_KEY,
-});
+// レプリケーションの設定を確認（役割は接続の順序から推測せず REPLICATION_ROLE で明示する）
+function checkReplicationConfig(): void {
+  if (!REPLICATION_TARGET && !REPLICATION_LISTEN && !REPLICATION_ROLE) {
+    return;
+  }
+  const valid =
+    (REPLICATION_ROLE === "primary" &&
+      REPLICATION_TARGET &&
+      !REPLICATION_LISTEN) ||
+    (REPLICATION_ROLE === "standby" &&
+      REPLICATION_LISTEN &&
+      !REPLICATION_TARGET);
+  if (!valid) {
+    throw new Error(
+      "レプリケーションには REPLICATION_ROLE=primary と REPLICATION_TARGET、または REPLICATION_ROLE=standby と REPLICATION_LISTEN を指定してください"
+    );
+  }
+}
 
-// クライアントごとの会話履歴を保持するMap
-// キー: クライアントの一意の識別子（IPアドレス:ポート）
+checkReplicationConfig();
+
+// 上流APIのバックエンド（モデルごとの送信先、接続プール、同時実行数、ヘルスチェック）
+// 利用可能なモデルはバックエンドの設定から決まる
+const backends = BackendRegistry.fromEnv();
+
+// セッションごとの会話履歴を保持するMap
+// キー: セッションID（/session 未指定の場合はクライアントID）
 // 値: 会話履歴の配列
 const conversationHistories = new Map<string, ChatCompletionMessageParam[]>();
 
-// クライアントごとの選択モデルを保持するMap
-// キー: クライアントの一意の識別子（IPアドレス:ポート）
+// 会話履歴の各メッセージをJSONに変換済みのセグメント（履歴と同じ並び）
+// リクエストボディはこれを連結して組み立てる
+const historySegments = new Map<string, Uint8Array[]>();
+
+// セッションごとの選択モデルを保持するMap
+// キー: セッションID（/session 未指定の場合はクライアントID）
 // 値: 選択されたモデル名
 const clientModels = new Map<string, string>();
 
+// セッションごとの生成パラメーター（/set で変更）
+const sessionSettings = new Map<string, GenerationSettings>();
+
+// 切断後に保持しているセッションの削除タイマー
+const sessionExpiryTimers = new Map<string, NodeJS.Timeout>();
+
+// 名前付きセッションごとの接続数（0 になったときだけ削除を予約する）
+const sessionAttachments = new Map<string, number>();
+
+// スタンバイでフェイルオーバー後にクライアントが変更したセッション
+// プライマリが復帰しても、スナップショットや変更で上書きしない
+const takenOverSessions = new Set<string>();
+
+// 冪等キーごとに完成したレスポンスを保持するストア
+// （キーはクライアントが生成するため、接続をまたいで共有する）
+const replayStore = new ReplayStore(
+  IDEMPOTENCY_RETENTION_MS,
+  IDEMPOTENCY_MAX_BYTES
+);
+
+// トークン使用量とプロンプトキャッシュの集計
+const usageStats = new UsageStats();
+
+// 上流APIのレート制限の予算（送信前に確保し、超えそうなら待つか切り替える）
+const rateLimiter = new RateLimiter();
+
+// 上流のバッチAPIによる一括実行のジョブ（/batch）
+const batchJobs = new BatchJobs((model) => backends.clientFor(model));
+
+// イベントループ遅延・GCの集計と、CPU・ヒーププロファイルの取得（/profile、SIGUSR2）
+const profiler = new Profiler();
+profiler.handleSignal();
+
+// レプリケーション（プライマリとしてスタンバイへ送信する場合のみ）
+let replicationPrimary: ReplicationPrimary | null = null;
+let replicationStandby: ReplicationStandby | null = null;
+
+// 受信したリクエストの通し番号（ログでリクエストを識別する）
+let lastRequestId = 0;
+
 // クライアントIDの生成
 function getClientId(socket: net.Socket): string {
   return `${socket.remoteAddress}:${socket.remotePort}`;
 }
 
+// セッション状態の変更を適用（スタンバイでの再生にも使う）
+function applyMutation(mutation: SessionMutation): void {
+  const sessionId = mutation.session;
+  switch (mutation.op) {
+    case "init": {
+      const system: ChatCompletionMessageParam = {
+        role: "system",
+        content: SYSTEM_PROMPT,
+      };
+      conversationHistories.set(sessionId, [system]);
+      historySegments.set(sessionId, [encodeMessageSegment(system)]);
+      // デフォルトモデルを設定
+      clientModels.set(sessionId, DEFAULT_MODEL);
+      sessionSettings.delete(sessionId);
+      break;
+    }
+
+    case "append": {
+      if (!conversationHistories.has(sessionId)) {
+        applyMutation({ op: "init", session: sessionId });
+      }
+      const history = conversationHistories.get(sessionId) || [];
+      const segments = historySegments.get(sessionId) || [];
+
+      // 新しいメッセージを追加（セグメントへの変換はこの1件分だけ）
+      const message: ChatCompletionMessageParam = {
+        role: mutation.role,
+        content: mutation.content,
+      };
+      history.push(message);
+      segments.push(encodeMessageSegment(message));
+
+      // 履歴が最大数を超えた場合、古いものからまとめて削除（システムメッセージは保持）
+      // 毎回1件ずつずらすと上流に送るプロンプトの先頭が毎回変わり、
+      // プロンプトキャッシュが効かなくなるため、数ターン分を一度に削除して
+      // 次に削除するまで先頭を変えないようにする
+      if (history.length > MAX_HISTORY + 1) {
+        const excess = history.length - (MAX_HISTORY + 1);
+        let count = Math.max(excess, HISTORY_EVICT_BLOCK);
+        // ユーザーとアシスタントの組を崩さないよう偶数件にそろえる
+        count += count % 2;
+        // 最新のメッセージは必ず残す
+        count = Math.min(count, history.length - 2);
+        history.splice(1, count);
+        segments.splice(1, count);
+        usageStats.recordEviction(count);
+      }
+      break;
+    }
+
+    case "model":
+      clientModels.set(sessionId, mutation.model);
+      break;
+
+    case "settings":
+      sessionSettings.set(sessionId, mutation.settings);
+      break;
+
+    case "drop":
+      conversationHistories.delete(sessionId);
+      historySegments.delete(sessionId);
+      clientModels.delete(sessionId);
+      sessionSettings.delete(sessionId);
+      break;
+
+    case "replay":
+      replayStore.set(
+        mutation.key,
+        Promise.resolve(new Uint8Array(Buffer.from(mutation.frame, "base64")))
+      );
+      break;
+  }
+}
+
+// セッション状態を変更し、スタンバイへ複製
+function mutateSession(mutation: SessionMutation): void {
+  applyMutation(mutation);
+  replicationPrimary?.publish(mutation);
+  // スタンバイ自身での変更は、このサーバーが引き継いだセッションとして扱う
+  if (replicationStandby && mutation.op !== "replay") {
+    if (mutation.op === "drop") {
+      takenOverSessions.delete(mutation.session);
+    } else {
+      takenOverSessions.add(mutation.session);
+    }
+  }
+}
+
+// このサーバーで使用中のセッション（プライマリからの複製で上書きしない）
+function isLocalSession(sessionId: string): boolean {
+  return takenOverSessions.has(sessionId) || sessionAttachments.has(sessionId);
+}
+
+// プライマリからの変更を適用（スタンバイ側）
+function applyReplicatedMutation(mutation: SessionMutation): void {
+  if (mutation.op !== "replay" && isLocalSession(mutation.session)) {
+    logger.warn("replication", "引き継いだセッションへの変更を無視", {
+      session: mutation.session,
+      op: mutation.op,
+    });
+    return;
+  }
+  applyMutation(mutation);
+}
+
+// 全セッションのスナップショット（レプリケーション接続時に送信）
+function snapshotSessions(): SessionSnapshot[] {
+  const sessions: SessionSnapshot[] = [];
+  for (const [sessionId, history] of conversationHistories) {
+    sessions.push({
+      session: sessionId,
+      model: getClientModel(sessionId),
+      settings: sessionSettings.get(sessionId),
+      messages: history.map((message) => ({
+        role: message.role,
+        content: String(message.content ?? ""),
+      })),
+    });
+  }
+  return sessions;
+}
+
+// スナップショットをセッションごとに反映する（スタンバイ側）
+// フェイルオーバー後にこのサーバーで使われているセッションは残す。スナップショットに
+// ないセッションも消さず、プライマリ切断時に予約した保持期間で削除する
+function restoreSessions(sessions: SessionSnapshot[]): void {
+  let kept = 0;
+  for (const snapshot of sessions) {
+    if (isLocalSession(snapshot.session)) {
+      kept++;
+      continue;
+    }
+    const messages = snapshot.messages as ChatCompletionMessageParam[];
+    conversationHistories.set(snapshot.session, messages);
+    historySegments.set(snapshot.session, messages.map(encodeMessageSegment));
+    clientModels.set(snapshot.session, snapshot.model);
+    if (snapshot.settings) {
+      sessionSettings.set(snapshot.session, snapshot.settings);
+    }
+    // プライマリが再び接続したので、削除はプライマリからの変更に任せる
+    cancelSessionExpiry(snapshot.session);
+  }
+  if (kept > 0) {
+    logger.warn("replication", "引き継いだセッションはスナップショットで上書きしない", {
+      sessions: kept,
+    });
+  }
+}
+
 // 会話履歴の初期化
-function initializeConversationHistory(clientId: string): void {
-  conversationHistories.set(clientId, [
-    { role: "system", content: "あなたは役立つアシスタントです。" },
-  ]);
-  // デフォルトモデルを設定
-  clientModels.set(clientId, DEFAULT_MODEL);
+function initializeConversationHistory(sessionId: string): void {
+  mutateSession({ op: "init", session: sessionId });
 }
 
-// クライアントのモデルを取得
-function getClientModel(clientId: string): string {
-  return clientModels.get(clientId) || DEFAULT_MODEL;
+// 既定のモデル（どのバックエンドも提供していない場合は最初のモデル）
+function getDefaultModel(): string {
+  if (backends.has(DEFAULT_MODEL)) {
+    return DEFAULT_MODEL;
+  }
+  return backends.models()[0] || DEFAULT_MODEL;
 }
 
-// クライアントのモデルを設定
-function setClientModel(clientId: string, model: string): boolean {
+// セッションのモデルを取得
+function getClientModel(sessionId: string): string {
+  return clientModels.get(sessionId) || getDefaultModel();
+}
+
+// セッションのモデルを設定
+function setClientModel(sessionId: string, model: string): boolean {
   // 指定されたモデルが利用可能なモデルリストに含まれているか確認
-  if (AVAILABLE_MODELS.includes(model)) {
-    clientModels.set(clientId, model);
+  if (backends.has(model)) {
+    mutateSession({ op: "model", session: sessionId, model });
     return true;
   }
   return false;
@@ -67,100 +336,528 @@ function setClientModel(clientId: string, model: string): boolean {
 
 // 利用可能なモデル一覧を取得
 function getAvailableModels(): string {
-  return AVAILABLE_MODELS.join(", ");
+  return backends.models().join(", ");
 }
 
 // 会話履歴の取得
 function getConversationHistory(
-  clientId: string
+  sessionId: string
 ): ChatCompletionMessageParam[] {
   // 会話履歴が存在しない場合は初期化
-  if (!conversationHistories.has(clientId)) {
-    initializeConversationHistory(clientId);
+  if (!conversationHistories.has(sessionId)) {
+    initializeConversationHistory(sessionId);
   }
-  return conversationHistories.get(clientId) || [];
+  return conversationHistories.get(sessionId) || [];
 }
 
 // 会話履歴の更新
 function updateConversationHistory(
-  clientId: string,
+  sessionId: string,
   role: "user" | "assistant",
   content: string
 ): void {
-  const history = getConversationHistory(clientId);
+  mutateSession({ op: "append", session: sessionId, role, content });
+}
 
-  // 新しいメッセージを追加
-  history.push({ role, content });
+// 会話履歴のクリア
+function clearConversationHistory(sessionId: string): void {
+  mutateSession({ op: "drop", session: sessionId });
+}
 
-  // 履歴が最大数を超えた場合、古いものから削除（システムメッセージは保持）
-  if (history.length > MAX_HISTORY + 1) {
-    // システムメッセージを保持するため、インデックス1から削除
-    history.splice(1, history.length - (MAX_HISTORY + 1));
+// 名前付きセッションへ接続（切断後の削除予定があれば取り消す）
+function attachSession(sessionId: string): boolean {
+  cancelSessionExpiry(sessionId);
+  const count = sessionAttachments.get(sessionId) || 0;
+  sessionAttachments.set(sessionId, count + 1);
+  if (conversationHistories.has(sessionId)) {
+    return true;
   }
+  initializeConversationHistory(sessionId);
+  return false;
+}
 
-  // 更新された履歴を保存
-  conversationHistories.set(clientId, history);
+// 名前付きセッションから切断（最後の接続が離れたら保持期間後に削除する）
+function detachSession(sessionId: string): void {
+  const count = (sessionAttachments.get(sessionId) || 0) - 1;
+  if (count > 0) {
+    sessionAttachments.set(sessionId, count);
+    return;
+  }
+  sessionAttachments.delete(sessionId);
+  scheduleSessionExpiry(sessionId);
 }
 
-// 会話履歴のクリア
-function clearConversationHistory(clientId: string): void {
-  conversationHistories.delete(clientId);
+// セッションを保持期間後に削除する（予約済みの場合は期間を延長）
+function scheduleSessionExpiry(sessionId: string): void {
+  cancelSessionExpiry(sessionId);
+  const timer = setTimeout(() => {
+    sessionExpiryTimers.delete(sessionId);
+    clearConversationHistory(sessionId);
+  }, SESSION_RETENTION_MS);
+  timer.unref();
+  sessionExpiryTimers.set(sessionId, timer);
+}
+
+// 削除の予約を取り消す
+function cancelSessionExpiry(sessionId: string): void {
+  const timer = sessionExpiryTimers.get(sessionId);
+  if (timer) {
+    clearTimeout(timer);
+    sessionExpiryTimers.delete(sessionId);
+  }
+}
+
+// プライマリから複製されたセッションに削除を予約する（スタンバイ側）
+// プライマリの接続中は削除もプライマリから届くため、切断時に予約する
+function scheduleReplicatedExpiry(): void {
+  for (const sessionId of conversationHistories.keys()) {
+    if (!sessionAttachments.has(sessionId)) {
+      scheduleSessionExpiry(sessionId);
+    }
+  }
+}
+
+// サーバー統計情報の表示用テキスト
+function formatStats(): string {
+  const lines = [
+    `セッション数: ${conversationHistories.size}`,
+    `保持中の応答: ${replayStore.size}`,
+    `トークン使用量: ${formatFields(usageStats.stats())}`,
+  ];
+  for (const [name, stats] of Object.entries(backends.stats())) {
+    lines.push(`バックエンド ${name}: ${formatFields(stats)}`);
+  }
+  lines.push(`バッチジョブ: ${formatFields(batchJobs.stats())}`);
+  lines.push(`ログ: ${formatFields(logger.stats())}`);
+  lines.push(`イベントループ遅延: ${formatFields(profiler.loopStats())}`);
+  lines.push(`GC: ${formatFields(profiler.gcStats())}`);
+  const requestTrace = requestTraceStats();
+  if (requestTrace) {
+    lines.push(`リクエストトレース: ${formatFields(requestTrace)}`);
+  }
+  const trace = traceStats();
+  if (trace) {
+    lines.push(`上流トレース: ${formatFields(trace)}`);
+  }
+  for (const [model, stats] of Object.entries(rateLimiter.stats())) {
+    lines.push(`レート制限 ${model}: ${formatFields(stats)}`);
+  }
+  if (replicationPrimary) {
+    lines.push(
+      `レプリケーション(送信): ${formatFields(replicationPrimary.stats())}`
+    );
+  }
+  if (replicationStandby) {
+    lines.push(
+      `レプリケーション(受信): ${formatFields({
+        ...replicationStandby.stats(),
+        taken_over: takenOverSessions.size,
+      })}`
+    );
+  }
+  return lines.join("\n");
+}
+
+// key=value 形式で連結
+function formatFields(fields: Record<string, unknown>): string {
+  return Object.entries(fields)
+    .map(([key, value]) => `${key}=${value}`)
+    .join(" ");
+}
+
+// 応答ごとのメタデータ（@meta=1 のリクエストにのみ付与）
+// 時間はミリ秒、received_at はサーバーが受信した時刻（UNIX時間）
+interface ResponseMeta {
+  received_at: number;
+  queue_ms: number; // 受信から上流へのリクエスト送信まで
+  ttft_ms: number; // 上流へのリクエスト送信から最初のトークンまで
+  upstream_ms: number; // 上流へのリクエスト送信から生成完了まで
+  total_ms: number; // 受信から応答フレームの生成まで
+  prompt_tokens: number;
+  completion_tokens: number;
+  cached_tokens: number;
+  trace_id: string; // リクエストのトレースID（@trace の値、またはサーバーが生成）
 }
 
 // レスポンス型の定義
 interface ResponseData {
   model: string;
   content: string;
+  error?: boolean;
+  meta: ResponseMeta;
 }
 
-// XMLビルダーの設定
-const xmlBuilder = new XMLBuilder({
-  format: true,
-  ignoreAttributes: false,
-});
+// 接続ごとの応答の形式（/encoding で変更した接続のみ）
+const frameFormats = new WeakMap<net.Socket, FrameFormat>();
+
+// 接続の形式で応答フレームを生成
+// 大きなレスポンスの生成はワーカースレッドで行われる
+function buildFrameFor(
+  socket: net.Socket,
+  response: Record<string, unknown>
+): Promise<Uint8Array> {
+  return buildResponseFrame(
+    { response },
+    OFFLOAD_THRESHOLD,
+    frameFormats.get(socket) || DEFAULT_FORMAT
+  );
+}
+
+// XMLレスポンスをクライアントに送信
+async function sendResponse(
+  socket: net.Socket,
+  response: Record<string, unknown>
+): Promise<void> {
+  const frame = await buildFrameFor(socket, response);
+  socket.write(frame);
+}
+
+// /encoding コマンドの処理（引数なしの場合は現在の形式を表示）
+// 例: /encoding sjis plain、/encoding utf8 xml
+function applyEncodingCommand(
+  socket: net.Socket,
+  args: string
+): Record<string, unknown> {
+  const current = frameFormats.get(socket) || DEFAULT_FORMAT;
+  const next: FrameFormat = { ...current };
+  for (const word of args.trim().split(/\s+/).filter((word) => word)) {
+    const lower = word.toLowerCase();
+    const encoding = parseEncodingName(lower);
+    if (encoding) {
+      next.encoding = encoding;
+    } else if (lower === "plain" || lower === "xml") {
+      next.plain = lower === "plain";
+    } else {
+      return {
+        type: "command",
+        command: "encoding",
+        success: false,
+        encoding: formatName(current),
+        message: `エラー: '${word}' は不明な形式です。utf8 / sjis / eucjp と xml / plain を指定できます。`,
+      };
+    }
+  }
+  // 応答から新しい形式で送る
+  frameFormats.set(socket, next);
+  return {
+    type: "command",
+    command: "encoding",
+    success: true,
+    encoding: formatName(next),
+    message: `応答の形式: ${formatName(next)}`,
+  };
+}
+
+// フレームを指定バイト位置から送信
+// 範囲外の位置が指定された場合はフレーム全体を送る（クライアントは先頭の
+// <response> を見て最初から受信し直す）
+function writeFrameFrom(
+  socket: net.Socket,
+  frame: Uint8Array,
+  offset: number,
+  done?: () => void
+): void {
+  if (offset > 0 && offset < frame.byteLength) {
+    socket.write(frame.subarray(offset), done);
+  } else {
+    socket.write(frame, done);
+  }
+}
+
+// /batch コマンドの処理
+// submit の場合、続けて送られたプロンプトファイルの行を lines で受け取る
+async function runBatchCommand(
+  sessionId: string,
+  args: string,
+  lines: string[]
+): Promise<Record<string, unknown>> {
+  const [subcommand, ...rest] = args.trim().split(/\s+/);
+  const id = rest[0] || "";
+  const response: Record<string, unknown> = {
+    type: "command",
+    command: "batch",
+    success: true,
+  };
+
+  try {
+    switch (subcommand.toLowerCase()) {
+      case "":
+      case "list": {
+        const jobs = batchJobs.list(sessionId);
+        response.message = jobs.length
+          ? jobs.map(formatJob).join("\n")
+          : "バッチジョブはありません。";
+        break;
+      }
+      case "submit": {
+        const prompts = parsePromptFile(lines);
+        if (prompts.length === 0) {
+          throw new Error("プロンプトがありません。");
+        }
+        if (prompts.length > BATCH_MAX_PROMPTS) {
+          throw new Error(`プロンプトは ${BATCH_MAX_PROMPTS} 件までです。`);
+        }
+        const model = getClientModel(sessionId);
+        const job = batchJobs.submit({
+          session: sessionId,
+          name: rest.join(" "),
+          model,
+          system: SYSTEM_PROMPT,
+          params: {
+            ...generationParams(model, sessionSettings.get(sessionId) || {}),
+          },
+          prompts,
+        });
+        response.message = `バッチジョブを登録しました: ${formatJob(job)}`;
+        break;
+      }
+      case "status": {
+        const job = batchJobs.get(id);
+        if (!job) {
+          throw new Error(`'${id}' というジョブはありません。`);
+        }
+        response.message = formatJob(job);
+        break;
+      }
+      case "results": {
+        // 結果は本文として返す（クライアントの /save でファイルに保存できる）
+        response.message = `${id} の結果`;
+        response.content = await batchJobs.results(id);
+        break;
+      }
+      case "cancel": {
+        const job = await batchJobs.cancel(id);
+        response.message = `取り消しを要求しました: ${formatJob(job)}`;
+        break;
+      }
+      default:
+        throw new Error(
+          `'${subcommand}' は不明なサブコマンドです。list / submit / status / results / cancel を指定できます。`
+        );
+    }
+  } catch (error) {
+    response.success = false;
+    response.message = `エラー: ${
+      error instanceof Error ? error.message : String(error)
+    }`;
+  }
+  return response;
+}
+
+// /profile コマンドの処理（@admin= で ADMIN_TOKEN を指定した場合のみ）
+async function runProfileCommand(
+  token: string | undefined,
+  args: string
+): Promise<Record<string, unknown>> {
+  const [subcommand, seconds] = args.trim().split(/\s+/);
+  const response: Record<string, unknown> = {
+    type: "command",
+    command: "profile",
+    success: true,
+  };
+
+  try {
+    if (!isAdmin(token)) {
+      throw new Error("管理コマンドの権限がありません。");
+    }
+    switch (subcommand.toLowerCase()) {
+      case "":
+      case "status":
+        response.message = [
+          profiler.status(),
+          `イベントループ遅延: ${formatFields(profiler.loopStats())}`,
+          `GC: ${formatFields(profiler.gcStats())}`,
+        ].join("\n");
+        break;
+      case "cpu": {
+        const file = await profiler.cpuProfile(
+          Number.parseInt(seconds || "10", 10) || 10
+        );
+        response.message = `CPUプロファイルを書き出しました: ${file}`;
+        break;
+      }
+      case "heap": {
+        const file = await profiler.heapSnapshot();
+        response.message = `ヒープスナップショットを書き出しました: ${file}`;
+        break;
+      }
+      case "reset":
+        profiler.reset();
+        response.message = "イベントループ遅延とGCの集計をリセットしました。";
+        break;
+      default:
+        throw new Error(
+          `'${subcommand}' は不明なサブコマンドです。status / cpu [秒数] / heap / reset を指定できます。`
+        );
+    }
+  } catch (error) {
+    response.success = false;
+    response.message = `エラー: ${
+      error instanceof Error ? error.message : String(error)
+    }`;
+  }
+  return response;
+}
 
 // メッセージ処理関数
 async function processMessage(
-  clientId: string,
-  message: string
+  sessionId: string,
+  message: string,
+  receivedAt: number,
+  trace: RequestTrace
 ): Promise<ResponseData> {
+  const meta: ResponseMeta = {
+    received_at: receivedAt,
+    queue_ms: 0,
+    ttft_ms: 0,
+    upstream_ms: 0,
+    total_ms: 0,
+    prompt_tokens: 0,
+    completion_tokens: 0,
+    cached_tokens: 0,
+    trace_id: trace.traceId,
+  };
+
+  // 送信先のバックエンドの枠（応答を受け終えたら解放する）
+  let lease: Lease | undefined;
+  let upstreamSpan: Span | undefined;
+
   try {
     // ユーザーメッセージを履歴に追加
-    updateConversationHistory(clientId, "user", message);
+    const historySpan = trace.begin("history");
+    updateConversationHistory(sessionId, "user", message);
 
     // 現在の会話履歴を取得
-    const history = getConversationHistory(clientId);
+    const history = getConversationHistory(sessionId);
+    historySpan.end({ messages: history.length });
+
+    // 送信するトークン数を見積もり、レート制限の予算を確保する
+    // （余裕がなければ待つか、切り替え先のモデルを使う）
+    const segments = historySegments.get(sessionId) || [];
+    const settings = sessionSettings.get(sessionId) || {};
+    const requestedModel = getClientModel(sessionId);
+    let promptBytes = 0;
+    for (const segment of segments) {
+      promptBytes += segment.byteLength;
+    }
+    const rateSpan = trace.begin("rate_limit");
+    const admission = await rateLimiter.acquire(
+      requestedModel,
+      estimateTokens(
+        promptBytes,
+        generationParams(requestedModel, settings).max_completion_tokens
+      )
+    );
+    const model = admission.model;
+    rateSpan.end({ requested: requestedModel, model });
 
-    // クライアントの選択モデルを取得
-    const model = getClientModel(clientId);
+    // 変換済みのセグメントを連結してリクエストボディを組み立てる
+    // 最初のトークンまでの時間を測るため、ストリーミングで受信する
+    // 出力トークン数・推論量・温度はセッションの設定から決める
+    const params = generationParams(model, settings);
+    const bodySpan = trace.begin("request_body");
+    const body = buildRequestBody(
+      {
+        model: model,
+        stream: true,
+        stream_options: { include_usage: true },
+        ...params,
+      },
+      segments
+    );
+    bodySpan.end({ bytes: body.byteLength });
 
-    // OpenAI APIにリクエスト送信（会話履歴を含む）
-    const completion = await openai.chat.completions.create({
-      model: model,
-      messages: history,
+    // モデルを提供するバックエンドを選び、同時実行数の枠を確保する
+    const backendSpan = trace.begin("backend_wait");
+    lease = await backends.acquire(model);
+    backendSpan.end({ backend: lease.backend });
+
+    // 上流APIにリクエスト送信（会話履歴を含む）
+    const startedAt = Date.now();
+    meta.queue_ms = startedAt - receivedAt;
+    // トレースIDは traceparent ヘッダーで上流に引き継ぐ
+    upstreamSpan = trace.begin("upstream");
+    // 送信する内容は組み立て済みの body で、第1引数はストリーミング指定などに
+    // 使われるだけのため、会話履歴（messages）は渡さない
+    const stream = await lease.client.chat.completions.create(
+      {
+        model: model,
+        stream: true,
+        stream_options: { include_usage: true },
+        ...params,
+      } as ChatCompletionCreateParamsStreaming,
+      { body, headers: { traceparent: trace.traceparent(upstreamSpan) } }
+    );
+
+    // 応答を連結（使用量は最後のチャンクに含まれる）
+    let content = "";
+    let usage: UsageLike | undefined;
+    for await (const chunk of stream) {
+      const delta = chunk.choices[0]?.delta?.content;
+      if (delta) {
+        if (!content) {
+          meta.ttft_ms = Date.now() - startedAt;
+          trace.mark("first_token");
+        }
+        content += delta;
+      }
+      if (chunk.usage) {
+        usage = chunk.usage;
+      }
+    }
+    meta.upstream_ms = Date.now() - startedAt;
+    lease.release();
+
+    // トークン使用量（キャッシュされたプロンプトトークンを含む）を記録し、
+    // 予約した見積もりを実績に置き換える
+    usageStats.record(usage);
+    if (usage) {
+      admission.reservation?.settle(
+        (usage.prompt_tokens || 0) + (usage.completion_tokens || 0)
+      );
+    }
+    meta.prompt_tokens = usage?.prompt_tokens || 0;
+    meta.completion_tokens = usage?.completion_tokens || 0;
+    meta.cached_tokens = usage?.prompt_tokens_details?.cached_tokens || 0;
+    upstreamSpan.end({
+      backend: lease.backend,
+      model,
+      ttft_ms: meta.ttft_ms,
+      prompt_tokens: meta.prompt_tokens,
+      completion_tokens: meta.completion_tokens,
     });
 
     // アシスタントの応答を取得
-    const responseContent =
-      completion.choices[0]?.message?.content ||
-      "レスポンスがありませんでした。";
+    const responseContent = content || "レスポンスがありませんでした。";
 
     // アシスタントの応答を履歴に追加
-    updateConversationHistory(clientId, "assistant", responseContent);
+    updateConversationHistory(sessionId, "assistant", responseContent);
 
     // モデル情報を含むレスポンスを返す
     return {
       model: model,
       content: responseContent,
+      meta,
     };
   } catch (error) {
-    console.error("OpenAI API エラー:", error);
+    lease?.release(error);
+    upstreamSpan?.end({
+      error: error instanceof Error ? error.message : String(error),
+    });
+    logger.error("upstream", "OpenAI API エラー", {
+      session: sessionId,
+      trace: trace.traceId,
+      model: getClientModel(sessionId),
+      error,
+    });
     // エラー時もモデル情報を含める
     return {
-      model: getClientModel(clientId),
+      model: getClientModel(sessionId),
       content: `エラーが発生しました: ${
         error instanceof Error ? error.message : String(error)
       }`,
+      error: true,
+      meta,
     };
   }
 }
@@ -168,14 +865,22 @@ async function processMessage(
 // TCPサーバーの作成
 const server = net.createServer((socket) => {
   const clientId = getClientId(socket);
-  console.log(`クライアント接続: ${clientId}`);
 
-  // 新しいクライアント接続時に会話履歴を初期化
-  initializeConversationHistory(clientId);
+  // 接続のセッションID（/session で名前付きセッションに切り替わる）
+  let sessionId = clientId;
+  let namedSession = false;
+
+  // 最初の行を受信してセッションを開始したか
+  // （プロキシのヘルスチェックの /health ではセッションを作らない）
+  let started = false;
+
+  // /batch submit に続いて受信中のプロンプトファイル
+  let pendingBatch: { args: string; expected: number; lines: string[] } | null =
+    null;
 
   // データ受信時の処理
   let buffer = "";
-  socket.on("data", async (data) => {
+  const handleData = async (data: Buffer) => {
     // データをUTF-8文字列として解釈
     const chunk = data.toString("utf-8");
     buffer += chunk;
@@ -185,49 +890,198 @@ const server = net.createServer((socket) => {
       const messages = buffer.split("\n");
       buffer = messages.pop() || ""; // 最後の不完全なメッセージを保持
 
+      // 最初の行で会話履歴を初期化する
+      // /health には応答して切断する（セッションの作成・複製・削除を伴わない）
+      if (!started) {
+        if (messages[0].trim() === "/health") {
+          socket.end("ok\n");
+          return;
+        }
+        started = true;
+        logger.info("connection", "クライアント接続", { client: clientId });
+        initializeConversationHistory(sessionId);
+      }
+
       for (const message of messages) {
+        // プロンプトファイルの行はコマンドとして解釈せずに集める
+        if (pendingBatch) {
+          pendingBatch.lines.push(message.replace(/\r$/, ""));
+          if (pendingBatch.lines.length < pendingBatch.expected) {
+            continue;
+          }
+          const { args, lines } = pendingBatch;
+          pendingBatch = null;
+          await sendResponse(
+            socket,
+            await runBatchCommand(sessionId, args, lines)
+          );
+          continue;
+        }
+
         if (message.trim()) {
-          console.log(`受信メッセージ (${clientId}): ${message}`);
+          const receivedAt = Date.now();
+          const requestId = ++lastRequestId;
+          if (logger.enabled("info")) {
+            logger.info("message", "受信メッセージ", {
+              session: sessionId,
+              req: requestId,
+              bytes: Buffer.byteLength(message),
+              body: truncate(message.replace(/@admin=\S*/, "@admin=***")),
+            });
+          }
+
+          // 行頭の属性（冪等キーなど）と本文を分離
+          const { attrs, body } = parseRequestLine(message);
 
           // 特殊コマンドの処理
-          const trimmedMessage = message.trim().toLowerCase();
+          const trimmedMessage = body.trim().toLowerCase();
 
           // 会話履歴クリアコマンド
           if (trimmedMessage === "/clear") {
             // 会話履歴をクリア
-            clearConversationHistory(clientId);
-            initializeConversationHistory(clientId);
+            clearConversationHistory(sessionId);
+            initializeConversationHistory(sessionId);
 
             // XMLレスポンスを送信
-            const xmlData = xmlBuilder.build({
-              response: {
-                type: "command",
-                command: "clear",
-                message: "会話履歴をクリアしました。",
-              },
+            await sendResponse(socket, {
+              type: "command",
+              command: "clear",
+              message: "会話履歴をクリアしました。",
             });
-            socket.write(`${xmlData}\n`);
+            continue;
+          }
+
+          // セッション接続コマンド
+          if (trimmedMessage.startsWith("/session ")) {
+            const requested = body.trim().substring(9).trim();
+            let success = false;
+            let message = "";
+
+            if (SESSION_ID_PATTERN.test(requested)) {
+              let resumed = true;
+              if (!namedSession) {
+                // 接続ごとの一時セッションは不要になるので削除
+                clearConversationHistory(sessionId);
+                resumed = attachSession(requested);
+              } else if (requested !== sessionId) {
+                // 別の名前付きセッションへ切り替え（同じIDなら接続数は変えない）
+                detachSession(sessionId);
+                resumed = attachSession(requested);
+              }
+              sessionId = requested;
+              namedSession = true;
+              success = true;
+              message = resumed
+                ? `セッション '${requested}' を再開しました。`
+                : `セッション '${requested}' を開始しました。`;
+            } else {
+              message = `エラー: '${requested}' は不正なセッションIDです。`;
+            }
+
+            // XMLレスポンスを送信
+            await sendResponse(socket, {
+              type: "command",
+              command: "session",
+              success: success,
+              session: sessionId,
+              message: message,
+            });
+            continue;
+          }
+
+          // 統計情報表示コマンド
+          if (trimmedMessage === "/stats") {
+            // XMLレスポンスを送信
+            await sendResponse(socket, {
+              type: "command",
+              command: "stats",
+              message: formatStats(),
+            });
+            continue;
+          }
+
+          // 応答の文字コード・フレーム形式の変更コマンド
+          if (
+            trimmedMessage === "/encoding" ||
+            trimmedMessage.startsWith("/encoding ")
+          ) {
+            await sendResponse(
+              socket,
+              applyEncodingCommand(socket, body.trim().substring(9))
+            );
+            continue;
+          }
+
+          // プロファイリングコマンド（管理者のみ）
+          if (
+            trimmedMessage === "/profile" ||
+            trimmedMessage.startsWith("/profile ")
+          ) {
+            await sendResponse(
+              socket,
+              await runProfileCommand(attrs.admin, body.trim().substring(8))
+            );
+            continue;
+          }
+
+          // 生成パラメーター設定コマンド
+          if (trimmedMessage === "/set" || trimmedMessage.startsWith("/set ")) {
+            const result = applySetCommand(
+              body.trim().substring(4),
+              sessionSettings.get(sessionId) || {}
+            );
+            if (result.success) {
+              mutateSession({
+                op: "settings",
+                session: sessionId,
+                settings: result.settings,
+              });
+            }
+
+            // XMLレスポンスを送信
+            await sendResponse(socket, {
+              type: "command",
+              command: "set",
+              success: result.success,
+              message: result.message,
+            });
+            continue;
+          }
+
+          // バッチジョブコマンド
+          // submit は @lines=行数 を付け、続けてプロンプトファイルの行を送る
+          if (
+            trimmedMessage === "/batch" ||
+            trimmedMessage.startsWith("/batch ")
+          ) {
+            const args = body.trim().substring(6);
+            const expected = Number.parseInt(attrs.lines || "0", 10) || 0;
+            if (/^\s*submit\b/i.test(args) && expected > 0) {
+              pendingBatch = { args, expected, lines: [] };
+              continue;
+            }
+            await sendResponse(
+              socket,
+              await runBatchCommand(sessionId, args, [])
+            );
             continue;
           }
 
           // モデル一覧表示コマンド
           if (trimmedMessage === "/models") {
-            const currentModel = getClientModel(clientId);
+            const currentModel = getClientModel(sessionId);
 
             // XMLレスポンスを送信
-            const xmlData = xmlBuilder.build({
-              response: {
-                type: "command",
-                command: "models",
-                current_model: currentModel,
-                available_models: {
-                  model: AVAILABLE_MODELS,
-                },
-                message:
-                  "モデルを変更するには /model モデル名 と入力してください。",
+            await sendResponse(socket, {
+              type: "command",
+              command: "models",
+              current_model: currentModel,
+              available_models: {
+                model: backends.models(),
               },
+              message:
+                "モデルを変更するには /model モデル名 と入力してください。",
             });
-            socket.write(`${xmlData}\n`);
             continue;
           }
 
@@ -237,7 +1091,7 @@ const server = net.createServer((socket) => {
             let success = false;
             let message = "";
 
-            if (setClientModel(clientId, modelName)) {
+            if (setClientModel(sessionId, modelName)) {
               success = true;
               message = `モデルを '${modelName}' に変更しました。`;
             } else {
@@ -245,54 +1099,181 @@ const server = net.createServer((socket) => {
             }
 
             // XMLレスポンスを送信
-            const xmlData = xmlBuilder.build({
-              response: {
-                type: "command",
-                command: "model_change",
-                success: success,
-                model: modelName,
-                message: message,
-              },
+            await sendResponse(socket, {
+              type: "command",
+              command: "model_change",
+              success: success,
+              model: modelName,
+              message: message,
             });
-            socket.write(`${xmlData}\n`);
             continue;
           }
 
-          // メッセージを処理してレスポンスを取得（クライアントIDを渡す）
-          const responseData = await processMessage(clientId, message);
+          // 冪等キー付きの再送で、結果が保持されていればそれを返す
+          const key = attrs.key;
+          const offset = Number.parseInt(attrs.offset || "0", 10) || 0;
+          const stored = key ? replayStore.get(key) : undefined;
+
+          // リクエストのトレース（再送では同じトレースIDが送られる）
+          const trace = new RequestTrace(attrs.trace, {
+            session: sessionId,
+            req: requestId,
+          });
+          if (stored) {
+            logger.info("resend", "保持済みレスポンスを再送", {
+              session: sessionId,
+              req: requestId,
+              trace: trace.traceId,
+              key,
+              offset,
+            });
+            const writeSpan = trace.begin("write");
+            writeFrameFrom(socket, await stored, offset, () => {
+              writeSpan.end();
+              trace.finish({ resend: 1, offset });
+            });
+            continue;
+          }
+
+          // メッセージを処理してレスポンスを生成（セッションIDを渡す）
+          // （@meta=1 の場合は時間とトークン数を本文の前に付ける）
+          let failed = false;
+          const frame = processMessage(sessionId, body, receivedAt, trace).then(
+            async (responseData) => {
+              const { meta } = responseData;
+              meta.total_ms = Date.now() - receivedAt;
+              failed = responseData.error === true;
+              const serializeSpan = trace.begin("serialize");
+              const bytes = await buildFrameFor(socket, {
+                model: responseData.model,
+                ...(attrs.meta === "1" ? { meta } : {}),
+                content: responseData.content,
+              });
+              serializeSpan.end({ bytes: bytes.byteLength });
+              // エラー応答は保持せず、再送時にもう一度処理する
+              if (key && responseData.error) {
+                replayStore.delete(key);
+              }
+              // フェイルオーバー後の再送でもスタンバイが同じ応答を返せるよう、
+              // 履歴の追加に続けて応答を複製する
+              if (key && !responseData.error && replicationPrimary) {
+                replicationPrimary.publish({
+                  op: "replay",
+                  session: sessionId,
+                  key,
+                  frame: Buffer.from(
+                    bytes.buffer,
+                    bytes.byteOffset,
+                    bytes.byteLength
+                  ).toString("base64"),
+                });
+              }
+              logger.info("response", "応答送信", {
+                session: sessionId,
+                req: requestId,
+                trace: trace.traceId,
+                model: responseData.model,
+                bytes: bytes.length,
+                ttft_ms: meta.ttft_ms,
+                total_ms: meta.total_ms,
+                error: responseData.error ? 1 : undefined,
+              });
+              return bytes;
+            }
+          );
+          if (key) {
+            replayStore.set(key, frame);
+          }
 
           // レスポンスをXML形式でクライアントに送信
-          const xmlData = xmlBuilder.build({
-            response: {
-              model: responseData.model,
-              content: responseData.content,
-            },
+          // （新たに生成した応答は、再送要求であっても先頭から送る）
+          const bytes = await frame;
+          const writeSpan = trace.begin("write");
+          socket.write(bytes, () => {
+            writeSpan.end({ bytes: bytes.byteLength });
+            trace.finish({ error: failed ? 1 : undefined });
           });
-          socket.write(`${xmlData}\n`);
         }
       }
     }
+  };
+  // 処理中の例外で（未処理の reject として）サーバー全体が落ちないようにする
+  socket.on("data", (data) => {
+    handleData(data).catch((error) => {
+      logger.error("connection", "受信データの処理に失敗", {
+        client: clientId,
+        session: sessionId,
+        error,
+      });
+    });
   });
 
   // クライアント切断時の処理
   socket.on("end", () => {
-    console.log(`クライアント切断: ${clientId}`);
-    // クライアント切断時に会話履歴を削除（メモリリーク防止）
-    clearConversationHistory(clientId);
+    if (!started) {
+      return;
+    }
+    logger.info("connection", "クライアント切断", {
+      client: clientId,
+      session: sessionId,
+    });
+    if (namedSession) {
+      // 名前付きセッションは再接続に備えて一定期間保持
+      // （他の接続がまだ使っている場合は、その切断まで保持）
+      detachSession(sessionId);
+    } else {
+      // クライアント切断時に会話履歴を削除（メモリリーク防止）
+      clearConversationHistory(sessionId);
+    }
   });
 
   // エラー発生時の処理
   socket.on("error", (err) => {
-    console.error(`ソケットエラー (${clientId}):`, err);
+    logger.warn("connection", "ソケットエラー", {
+      client: clientId,
+      session: sessionId,
+      error: err,
+    });
   });
 });
 
 // サーバー起動
-server.listen(PORT, HOST, () => {
-  console.log(`TCP/IPサーバーが起動しました - ${HOST}:${PORT}`);
+// バックエンドの初回ヘルスチェック（モデル一覧の取得）を待ってから受け付ける
+backends.start().then(() => {
+  server.listen(PORT, HOST, () => {
+    logger.info("server", `TCP/IPサーバーが起動しました - ${HOST}:${PORT}`);
+    logger.info("server", `利用可能なモデル: ${getAvailableModels()}`);
+  });
 });
 
+// レプリケーションの開始
+if (REPLICATION_ROLE === "primary") {
+  const target = parseHostPort(REPLICATION_TARGET, 3100);
+  replicationPrimary = new ReplicationPrimary(
+    target.host,
+    target.port,
+    snapshotSessions
+  );
+  replicationPrimary.start();
+}
+if (REPLICATION_ROLE === "standby") {
+  const listen = parseHostPort(
+    REPLICATION_LISTEN.includes(":")
+      ? REPLICATION_LISTEN
+      : `0.0.0.0:${REPLICATION_LISTEN}`,
+    3100
+  );
+  replicationStandby = new ReplicationStandby(
+    listen.host,
+    listen.port,
+    restoreSessions,
+    applyReplicatedMutation,
+    scheduleReplicatedExpiry
+  );
+  replicationStandby.start();
+}
+
 // サーバーエラー処理
 server.on("error", (err) => {
-  console.error("サーバーエラー:", err);
+  logger.error("server", "サーバーエラー", { error: err });
 });
@@ -0,0 +1,243 @@
+import * as fs from "node:fs";
+
+// 構造化ログ
+//
+// console.log は呼び出しごとに同期で書き込むため、負荷が高いと受信メッセージの
+// ログ（大きな貼り付けを含む）だけで応答時間とディスクI/Oを消費する。
+// ログ行はメモリ上にためてまとめて非同期で書き込み、レベル、カテゴリごとの
+// サンプリング、本文の切り詰めで量を抑える。書き込みが追いつかずバッファが
+// 上限に達した場合は、待たずに捨てて件数を数える。
+//
+// 1行の形式は LOG_FORMAT で選ぶ:
+//   text: 2025-01-01T00:00:00.000Z INFO  [message] 受信メッセージ session=abc req=12 body="..."
+//   json: {"time":"...","level":"info","category":"message","msg":"受信メッセージ","session":"abc",...}
+
+// 環境変数からの設定取得
+const LEVEL = process.env.LOG_LEVEL || "info"; // debug, info, warn, error
+const FORMAT = process.env.LOG_FORMAT || "text"; // text または json
+const LOG_FILE = process.env.LOG_FILE || ""; // 未指定の場合は標準出力
+const SAMPLING = process.env.LOG_SAMPLE || ""; // "カテゴリ=割合,..."（例: message=0.1）
+const MAX_BODY = Number.parseInt(process.env.LOG_MAX_BODY || "200", 10); // 本文の最大文字数
+const FLUSH_MS = Number.parseInt(process.env.LOG_FLUSH_MS || "100", 10); // まとめて書き込む間隔
+const MAX_BUFFER = Number.parseInt(
+  process.env.LOG_MAX_BUFFER || String(1024 * 1024),
+  10
+); // 書き込み待ちの上限（バイト）
+
+const LEVELS = { debug: 10, info: 20, warn: 30, error: 40 } as const;
+export type LogLevel = keyof typeof LEVELS;
+const LABELS: Record<LogLevel, string> = {
+  debug: "DEBUG",
+  info: "INFO ",
+  warn: "WARN ",
+  error: "ERROR",
+};
+
+// ログ行に付ける値（undefined は出力しない）
+export type LogFields = Record<string, unknown>;
+
+// カテゴリごとのサンプリング割合（"message=0.1,response=0.5"）
+function parseSampling(value: string): Map<string, number> {
+  const rates = new Map<string, number>();
+  for (const item of value.split(",")) {
+    const [category, rate] = item.split("=");
+    const parsed = Number.parseFloat(rate);
+    if (category?.trim() && Number.isFinite(parsed)) {
+      rates.set(category.trim(), Math.min(1, Math.max(0, parsed)));
+    }
+  }
+  return rates;
+}
+
+// 本文を切り詰める（改行はそのまま出さない）
+export function truncate(text: string, max = MAX_BODY): string {
+  const flat = text.replace(/\r?\n/g, "\\n");
+  if (max <= 0 || flat.length <= max) {
+    return flat;
+  }
+  return `${flat.substring(0, max)}…(${text.length}文字)`;
+}
+
+// テキスト形式の値（空白や引用符を含む場合は JSON の文字列として出す）
+function formatValue(value: unknown): string {
+  const text =
+    typeof value === "string"
+      ? value
+      : value instanceof Error
+        ? value.message
+        : typeof value === "object"
+          ? JSON.stringify(value)
+          : String(value);
+  return /[\s"=]/.test(text) || text === "" ? JSON.stringify(text) : text;
+}
+
+export class Logger {
+  private readonly threshold: number;
+  private readonly rates: Map<string, number>;
+  private readonly credits = new Map<string, number>();
+  private readonly fd: number;
+  private pending: string[] = [];
+  private pendingBytes = 0;
+  private writing = false;
+  private timer: NodeJS.Timeout | null = null;
+  private written = 0;
+  private sampledOut = 0;
+  private dropped = 0;
+
+  constructor() {
+    this.threshold = LEVELS[LEVEL as LogLevel] ?? LEVELS.info;
+    this.rates = parseSampling(SAMPLING);
+    this.fd = LOG_FILE ? fs.openSync(LOG_FILE, "a") : 1;
+    // 終了時に残りを同期で書き出す
+    process.once("exit", () => this.flushSync());
+  }
+
+  debug(category: string, msg: string, fields?: LogFields): void {
+    this.log("debug", category, msg, fields);
+  }
+
+  info(category: string, msg: string, fields?: LogFields): void {
+    this.log("info", category, msg, fields);
+  }
+
+  warn(category: string, msg: string, fields?: LogFields): void {
+    this.log("warn", category, msg, fields);
+  }
+
+  error(category: string, msg: string, fields?: LogFields): void {
+    this.log("error", category, msg, fields);
+  }
+
+  // レベルで出力されるか（本文の整形を省くため）
+  enabled(level: LogLevel): boolean {
+    return LEVELS[level] >= this.threshold;
+  }
+
+  log(level: LogLevel, category: string, msg: string, fields?: LogFields): void {
+    if (!this.enabled(level) || !this.sample(level, category)) {
+      return;
+    }
+    const line = `${this.format(level, category, msg, fields)}\n`;
+    if (this.pendingBytes + line.length > MAX_BUFFER) {
+      this.dropped++;
+      return;
+    }
+    this.pending.push(line);
+    this.pendingBytes += line.length;
+    if (this.pendingBytes >= 64 * 1024) {
+      this.flush();
+    } else if (!this.timer) {
+      this.timer = setTimeout(() => this.flush(), FLUSH_MS);
+      this.timer.unref();
+    }
+  }
+
+  // 統計情報
+  stats(): Record<string, number | string> {
+    return {
+      level: LEVEL,
+      written: this.written,
+      sampled_out: this.sampledOut,
+      dropped: this.dropped,
+      buffered_bytes: this.pendingBytes,
+    };
+  }
+
+  // 割合に応じて間引く（警告・エラーは常に出力する）
+  // 乱数ではなく割合を積み上げ、1を超えるごとに1行出す
+  private sample(level: LogLevel, category: string): boolean {
+    const rate = this.rates.get(category);
+    if (rate === undefined || LEVELS[level] >= LEVELS.warn) {
+      return true;
+    }
+    const credit = (this.credits.get(category) || 0) + rate;
+    if (credit >= 1) {
+      this.credits.set(category, credit - 1);
+      return true;
+    }
+    this.credits.set(category, credit);
+    this.sampledOut++;
+    return false;
+  }
+
+  private format(
+    level: LogLevel,
+    category: string,
+    msg: string,
+    fields?: LogFields
+  ): string {
+    const time = new Date().toISOString();
+    if (FORMAT === "json") {
+      const entry: LogFields = { time, level, category, msg };
+      for (const [key, value] of Object.entries(fields || {})) {
+        if (value !== undefined) {
+          entry[key] = value instanceof Error ? value.message : value;
+        }
+      }
+      return JSON.stringify(entry);
+    }
+    let line = `${time} ${LABELS[level]} [${category}] ${msg}`;
+    for (const [key, value] of Object.entries(fields || {})) {
+      if (value !== undefined) {
+        line += ` ${key}=${formatValue(value)}`;
+      }
+    }
+    return line;
+  }
+
+  // たまった行をまとめて非同期で書き込む（書き込み中なら完了後に続ける）
+  private flush(): void {
+    if (this.timer) {
+      clearTimeout(this.timer);
+      this.timer = null;
+    }
+    if (this.writing || this.pending.length === 0) {
+      return;
+    }
+    const lines = this.pending;
+    const data = Buffer.from(lines.join(""));
+    this.pending = [];
+    this.pendingBytes = 0;
+    this.writing = true;
+    const write = (offset: number) => {
+      fs.write(this.fd, data, offset, data.length - offset, null, (err, n) => {
+        // 標準出力が非ブロッキングのパイプの場合は EAGAIN で再試行する
+        if (err && err.code === "EAGAIN") {
+          setTimeout(() => write(offset), 1);
+          return;
+        }
+        if (!err && offset + n < data.length) {
+          write(offset + n);
+          return;
+        }
+        this.writing = false;
+        if (err) {
+          this.dropped += lines.length;
+        } else {
+          this.written += lines.length;
+        }
+        if (this.pending.length > 0) {
+          this.flush();
+        }
+      });
+    };
+    write(0);
+  }
+
+  private flushSync(): void {
+    if (this.pending.length === 0) {
+      return;
+    }
+    try {
+      fs.writeSync(this.fd, this.pending.join(""));
+      this.written += this.pending.length;
+    } catch {
+      this.dropped += this.pending.length;
+    }
+    this.pending = [];
+    this.pendingBytes = 0;
+  }
+}
+
+// サーバー全体で共有するロガー
+export const logger = new Logger();
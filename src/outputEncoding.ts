@@ -0,0 +1,192 @@
+// 応答の文字コードとフレーム形式（接続ごとに /encoding で選ぶ）
+//
+// 古い環境のクライアント（himawari/client.hmw など）は、受信したUTF-8の応答を
+// 毎回自分で Shift_JIS に変換し、さらに実体参照を置換で戻しているため、長い応答で
+// 目に見えて遅い。サーバー側で一度だけ Shift_JIS / EUC-JP に変換して送り、
+// 実体参照を使わない plain 形式のフレームも選べるようにする。
+//
+// 変換表は TextDecoder（Shift_JIS / EUC-JP のデコードは WHATWG Encoding 準拠）で
+// 全コードを一度デコードし、逆引きして作る（初回の使用時に作成）。
+// 表にない文字（絵文字など）は "?" にする。
+//
+// plain 形式のフレーム:
+//   @response <以降のバイト数>\n
+//   command: models\n          （本文以外の要素。改行は空白に置き換える）
+//   available_models: a, b\n
+//   \n
+//   <本文（content、なければ message）>\n
+
+// 出力する文字コード
+export type OutputEncoding = "utf-8" | "shift_jis" | "euc-jp";
+
+// フレーム形式
+export interface FrameFormat {
+  encoding: OutputEncoding;
+  plain: boolean; // true の場合は XML ではなく plain 形式
+}
+
+// 既定（UTF-8 の XML）
+export const DEFAULT_FORMAT: FrameFormat = { encoding: "utf-8", plain: false };
+
+// /encoding で指定できる名前
+const ENCODING_NAMES: Record<string, OutputEncoding> = {
+  utf8: "utf-8",
+  "utf-8": "utf-8",
+  sjis: "shift_jis",
+  shift_jis: "shift_jis",
+  "shift-jis": "shift_jis",
+  cp932: "shift_jis",
+  eucjp: "euc-jp",
+  "euc-jp": "euc-jp",
+};
+
+export function parseEncodingName(name: string): OutputEncoding | null {
+  return ENCODING_NAMES[name.toLowerCase()] || null;
+}
+
+// 表示用の形式名
+export function formatName(format: FrameFormat): string {
+  return `${format.encoding} ${format.plain ? "plain" : "xml"}`;
+}
+
+const utf8 = new TextEncoder();
+const REPLACEMENT = 0x3f; // "?"
+
+// 文字コードごとの変換表（UTF-16のコード単位 → 1〜2バイト、0は表にない文字）
+const tables = new Map<OutputEncoding, Uint16Array>();
+
+// デコーダーで全コードをデコードし、逆引きの表を作る
+// 同じ文字に複数のコードがある場合は最初のもの（JIS X 0208 の位置）を使う
+function buildTable(encoding: "shift_jis" | "euc-jp"): Uint16Array {
+  const table = new Uint16Array(0x10000);
+  const decoder = new TextDecoder(encoding);
+  const add = (bytes: number[]) => {
+    const text = decoder.decode(Uint8Array.from(bytes));
+    if (text.length !== 1 || text === "\ufffd") {
+      return;
+    }
+    const code = text.charCodeAt(0);
+    if (table[code] === 0) {
+      table[code] = bytes.length === 1 ? bytes[0] : (bytes[0] << 8) | bytes[1];
+    }
+  };
+
+  if (encoding === "shift_jis") {
+    // 半角カナ
+    for (let byte = 0xa1; byte <= 0xdf; byte++) {
+      add([byte]);
+    }
+    for (let lead = 0x81; lead <= 0xfc; lead++) {
+      // 0xED〜0xEF は NEC選定IBM拡張文字（0xFA〜0xFC と重複）のため使わない
+      if ((lead >= 0xa0 && lead < 0xe0) || (lead >= 0xed && lead <= 0xef)) {
+        continue;
+      }
+      for (let trail = 0x40; trail <= 0xfc; trail++) {
+        if (trail !== 0x7f) {
+          add([lead, trail]);
+        }
+      }
+    }
+  } else {
+    // 半角カナ（SS2）と JIS X 0208
+    for (let byte = 0xa1; byte <= 0xdf; byte++) {
+      add([0x8e, byte]);
+    }
+    for (let lead = 0xa1; lead <= 0xfe; lead++) {
+      for (let trail = 0xa1; trail <= 0xfe; trail++) {
+        add([lead, trail]);
+      }
+    }
+  }
+
+  // WHATWG のエンコーダーと同じ置き換え（円記号・オーバーライン・マイナス）
+  table[0x00a5] = 0x5c;
+  table[0x203e] = 0x7e;
+  table[0x2212] = table[0xff0d];
+  return table;
+}
+
+function getTable(encoding: "shift_jis" | "euc-jp"): Uint16Array {
+  let table = tables.get(encoding);
+  if (!table) {
+    table = buildTable(encoding);
+    tables.set(encoding, table);
+  }
+  return table;
+}
+
+// 文字列を指定の文字コードのバイト列に変換
+export function encodeText(text: string, encoding: OutputEncoding): Uint8Array {
+  if (encoding === "utf-8") {
+    return utf8.encode(text);
+  }
+  const table = getTable(encoding);
+  // 1コード単位は最大2バイト
+  const out = new Uint8Array(text.length * 2);
+  let length = 0;
+  for (let i = 0; i < text.length; i++) {
+    const code = text.charCodeAt(i);
+    if (code < 0x80) {
+      out[length++] = code;
+      continue;
+    }
+    const bytes = table[code];
+    if (bytes === 0) {
+      out[length++] = REPLACEMENT;
+      // サロゲートペアは1文字として置き換える
+      if (code >= 0xd800 && code <= 0xdbff && i + 1 < text.length) {
+        const next = text.charCodeAt(i + 1);
+        if (next >= 0xdc00 && next <= 0xdfff) {
+          i++;
+        }
+      }
+      continue;
+    }
+    if (bytes > 0xff) {
+      out[length++] = bytes >> 8;
+    }
+    out[length++] = bytes & 0xff;
+  }
+  return out.subarray(0, length);
+}
+
+// plain 形式の見出しの値（配列はカンマ区切り、オブジェクトは key=value）
+function headerValue(value: unknown): string {
+  if (Array.isArray(value)) {
+    return value.map(headerValue).join(", ");
+  }
+  if (value !== null && typeof value === "object") {
+    const entries = Object.entries(value);
+    // <available_models><model>...</model></available_models> のような入れ子
+    if (entries.length === 1) {
+      return headerValue(entries[0][1]);
+    }
+    return entries
+      .map(([key, item]) => `${key}=${headerValue(item)}`)
+      .join(" ");
+  }
+  return String(value).replace(/\r?\n/g, " ");
+}
+
+// plain 形式のフレームを生成（{ response: {...} } を受け取る）
+export function buildPlainFrame(
+  data: unknown,
+  encoding: OutputEncoding
+): Uint8Array {
+  const response =
+    (data as { response?: Record<string, unknown> }).response || {};
+  const bodyKey = "content" in response ? "content" : "message";
+  const lines: string[] = [];
+  for (const [key, value] of Object.entries(response)) {
+    if (key !== bodyKey && value !== undefined) {
+      lines.push(`${key}: ${headerValue(value)}`);
+    }
+  }
+  const body = response[bodyKey] === undefined ? "" : String(response[bodyKey]);
+  const block = encodeText(`${lines.join("\n")}\n\n${body}\n`, encoding);
+  const head = utf8.encode(`@response ${block.byteLength}\n`);
+  const frame = new Uint8Array(head.byteLength + block.byteLength);
+  frame.set(head);
+  frame.set(block, head.byteLength);
+  return frame;
+}
@@ -0,0 +1,199 @@
+import { timingSafeEqual } from "node:crypto";
+import * as fs from "node:fs";
+import { Session } from "node:inspector";
+import * as path from "node:path";
+import {
+  PerformanceObserver,
+  constants as perfConstants,
+  createHistogram,
+  monitorEventLoopDelay,
+} from "node:perf_hooks";
+import * as v8 from "node:v8";
+import { logger } from "./logger";
+
+// 稼働中のサーバーのプロファイリング
+//
+// 本番で遅くなったときに、再起動せずにどこで時間を使っているかを調べる。
+// 管理コマンド（ADMIN_TOKEN による認証）または SIGUSR2 で、指定秒数の
+// CPUプロファイル（.cpuprofile）やヒープスナップショット（.heapsnapshot）を
+// PROFILE_DIR に書き出す。Chrome DevTools の Performance / Memory パネルで開ける。
+//
+// イベントループの遅延とGCの停止時間はヒストグラムで常に集計し、/stats で
+// 確認できる（履歴処理やXML生成の劣化を、プロファイルを取る前に見つけるため）。
+
+// 環境変数からの設定取得
+const ADMIN_TOKEN = process.env.ADMIN_TOKEN || ""; // 未設定の場合は管理コマンドを無効にする
+const PROFILE_DIR = process.env.PROFILE_DIR || "profiles"; // 書き出し先
+const SIGNAL_SECONDS = Number.parseInt(
+  process.env.PROFILE_SIGNAL_SECONDS || "10",
+  10
+); // SIGUSR2 で取るCPUプロファイルの秒数
+const MAX_SECONDS = Number.parseInt(
+  process.env.PROFILE_MAX_SECONDS || "120",
+  10
+); // CPUプロファイルの最大秒数
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// GCの種類（PerformanceEntry の detail.kind）
+const GC_KINDS: Record<number, string> = {
+  [perfConstants.NODE_PERFORMANCE_GC_MAJOR]: "major",
+  [perfConstants.NODE_PERFORMANCE_GC_MINOR]: "minor",
+  [perfConstants.NODE_PERFORMANCE_GC_INCREMENTAL]: "incremental",
+  [perfConstants.NODE_PERFORMANCE_GC_WEAKCB]: "weakcb",
+};
+
+// 管理コマンドのトークンの確認（長さの違いも含めて一定時間で比較する）
+export function isAdmin(token: string | undefined): boolean {
+  if (!ADMIN_TOKEN || !token) {
+    return false;
+  }
+  const expected = Buffer.from(ADMIN_TOKEN);
+  const actual = Buffer.from(token);
+  return (
+    expected.length === actual.length && timingSafeEqual(expected, actual)
+  );
+}
+
+// ナノ秒をミリ秒（小数点以下2桁）に
+function toMs(ns: number): number {
+  return Math.round(ns / 10000) / 100;
+}
+
+export class Profiler {
+  private readonly loopDelay = monitorEventLoopDelay({ resolution: 10 });
+  private readonly gcPauses = createHistogram();
+  private readonly gcCounts = new Map<string, number>();
+  private readonly observer: PerformanceObserver;
+  private gcTotalNs = 0;
+  private since = Date.now();
+  private running: string | null = null; // 取得中のプロファイルの種類
+
+  constructor() {
+    this.loopDelay.enable();
+    this.observer = new PerformanceObserver((list) => {
+      for (const entry of list.getEntries()) {
+        const ns = Math.max(1, Math.round(entry.duration * 1e6));
+        this.gcPauses.record(ns);
+        this.gcTotalNs += ns;
+        const detail = entry.detail as { kind?: number } | undefined;
+        const kind = GC_KINDS[detail?.kind ?? -1] || "other";
+        this.gcCounts.set(kind, (this.gcCounts.get(kind) || 0) + 1);
+      }
+    });
+    this.observer.observe({ entryTypes: ["gc"] });
+  }
+
+  // SIGUSR2 でCPUプロファイルを取る
+  handleSignal(): void {
+    process.on("SIGUSR2", () => {
+      this.cpuProfile(SIGNAL_SECONDS).catch((error) => {
+        logger.warn("profile", "CPUプロファイルを取得できません", { error });
+      });
+    });
+  }
+
+  // 指定秒数のCPUプロファイルを取り、書き出したファイルのパスを返す
+  async cpuProfile(seconds: number): Promise<string> {
+    const duration = Math.min(Math.max(1, seconds), MAX_SECONDS);
+    this.begin("cpu");
+    const session = new Session();
+    const post = <T>(method: string, params?: object) =>
+      new Promise<T>((resolve, reject) => {
+        session.post(method, params, (err, result) =>
+          err ? reject(err) : resolve(result as T)
+        );
+      });
+    try {
+      session.connect();
+      await post("Profiler.enable");
+      await post("Profiler.start");
+      logger.info("profile", "CPUプロファイル開始", { seconds: duration });
+      await sleep(duration * 1000);
+      const { profile } = await post<{ profile: object }>("Profiler.stop");
+      const file = await this.output("cpu", "cpuprofile");
+      await fs.promises.writeFile(file, JSON.stringify(profile));
+      logger.info("profile", "CPUプロファイル書き出し", { file });
+      return file;
+    } finally {
+      session.disconnect();
+      this.running = null;
+    }
+  }
+
+  // ヒープスナップショットを書き出す（取得中はイベントループが止まる）
+  async heapSnapshot(): Promise<string> {
+    this.begin("heap");
+    try {
+      const file = await this.output("heap", "heapsnapshot");
+      const startedAt = Date.now();
+      v8.writeHeapSnapshot(file);
+      logger.info("profile", "ヒープスナップショット書き出し", {
+        file,
+        ms: Date.now() - startedAt,
+      });
+      return file;
+    } finally {
+      this.running = null;
+    }
+  }
+
+  // ヒストグラムを0から集計し直す（変更の前後を比べる場合）
+  reset(): void {
+    this.loopDelay.reset();
+    this.gcPauses.reset();
+    this.gcCounts.clear();
+    this.gcTotalNs = 0;
+    this.since = Date.now();
+  }
+
+  // イベントループ遅延の統計情報（ミリ秒）
+  loopStats(): Record<string, number> {
+    const h = this.loopDelay;
+    return {
+      p50_ms: toMs(h.percentile(50)),
+      p99_ms: toMs(h.percentile(99)),
+      max_ms: toMs(h.max),
+      mean_ms: toMs(h.mean || 0),
+      since_s: Math.round((Date.now() - this.since) / 1000),
+    };
+  }
+
+  // GCの停止時間の統計情報（ミリ秒）
+  gcStats(): Record<string, number> {
+    const h = this.gcPauses;
+    const stats: Record<string, number> = {
+      count: h.count,
+      total_ms: toMs(this.gcTotalNs),
+      p50_ms: h.count ? toMs(h.percentile(50)) : 0,
+      p99_ms: h.count ? toMs(h.percentile(99)) : 0,
+      max_ms: h.count ? toMs(h.max) : 0,
+    };
+    for (const [kind, count] of this.gcCounts) {
+      stats[kind] = count;
+    }
+    return stats;
+  }
+
+  // 取得中の種類
+  status(): string {
+    return this.running ? `${this.running} プロファイル取得中` : "待機中";
+  }
+
+  // 同時に取れるプロファイルは1つまで
+  private begin(kind: string): void {
+    if (this.running) {
+      throw new Error(`${this.running} プロファイルを取得中です`);
+    }
+    this.running = kind;
+  }
+
+  private async output(kind: string, extension: string): Promise<string> {
+    await fs.promises.mkdir(PROFILE_DIR, { recursive: true });
+    const stamp = new Date().toISOString().replace(/[:.]/g, "-");
+    return path.join(
+      PROFILE_DIR,
+      `${kind}-${stamp}-${process.pid}.${extension}`
+    );
+  }
+}
@@ -0,0 +1,52 @@
+// リクエスト行の解析
+//
+// クライアントは1行1リクエストで送信する。行頭には任意で
+// 「@名前=値」形式の属性を空白区切りで並べることができる。
+//   例: @key=5f3a9c01d2e4 @offset=1024 こんにちは
+// 属性以降の部分がメッセージ本文（またはコマンド）として扱われる。
+// 属性として扱うのは既知の名前だけで、それ以外のトークン（例: 「@todo=あとで直す」）
+// が現れた時点で解析をやめ、そこからを本文とする。
+
+// 解析済みのリクエスト
+export interface ParsedRequest {
+  attrs: Record<string, string>;
+  body: string;
+}
+
+// 属性トークンの形式
+const ATTR_PATTERN = /^@([a-z_]+)=(\S*)$/;
+
+// 既知の属性
+//   key     冪等キー（再送時に同じ応答を返す）
+//   offset  再開する応答のバイト位置
+//   meta    1 の場合、時間とトークン数を応答に付ける
+//   trace   リクエストのトレースID
+//   lines   続けて送る行数（/batch submit）
+//   admin   管理コマンドのトークン（/profile）
+export const KNOWN_ATTRS = new Set([
+  "key",
+  "offset",
+  "meta",
+  "trace",
+  "lines",
+  "admin",
+]);
+
+// リクエスト行を属性と本文に分解
+export function parseRequestLine(line: string): ParsedRequest {
+  const attrs: Record<string, string> = {};
+  let rest = line.trimStart();
+
+  while (rest.startsWith("@")) {
+    const end = rest.search(/\s/);
+    const token = end < 0 ? rest : rest.substring(0, end);
+    const match = ATTR_PATTERN.exec(token);
+    if (!match || !KNOWN_ATTRS.has(match[1])) {
+      break;
+    }
+    attrs[match[1]] = match[2];
+    rest = end < 0 ? "" : rest.substring(end).trimStart();
+  }
+
+  return { attrs, body: rest };
+}
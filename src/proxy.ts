@@ -0,0 +1,306 @@
+import { createHash } from "node:crypto";
+import * as net from "node:net";
+import { config } from "dotenv";
+import { parseHostPort } from "./replication";
+
+// セッション対応TCPフロントプロキシ
+//
+// クライアント接続の最初の行が「/session ID」であれば、そのIDをコンシステント
+// ハッシュで振り分け先のバックエンドに対応付ける（それ以外は接続元アドレスで
+// 振り分ける）。最初の行を含め、以降のデータは解析せずにそのまま中継する。
+// バックエンドの追加・削除で移動するのは、そのノードが担当していた範囲のみ。
+
+// 環境変数の読み込み
+config();
+
+// 環境変数からの設定取得
+const PORT = Number.parseInt(process.env.PROXY_PORT || "4000", 10);
+const HOST = process.env.PROXY_HOST || "0.0.0.0";
+const BACKENDS = (process.env.PROXY_BACKENDS || "127.0.0.1:3000")
+  .split(",")
+  .map((value) => value.trim())
+  .filter((value) => value);
+const ADMIN_PORT = Number.parseInt(process.env.PROXY_ADMIN_PORT || "0", 10); // 0の場合は管理ポートを開かない
+const HEALTH_INTERVAL_MS = Number.parseInt(
+  process.env.PROXY_HEALTH_INTERVAL_MS || "2000",
+  10
+);
+const VIRTUAL_NODES = 160; // バックエンドあたりの仮想ノード数
+const MAX_FIRST_LINE = 4096; // 振り分け前に読み込む最初の行の最大長
+
+// ハッシュ値（32ビット）
+function hash32(value: string): number {
+  return createHash("md5").update(value).digest().readUInt32BE(0);
+}
+
+// コンシステントハッシュリング
+export class HashRing {
+  private points: { hash: number; node: string }[] = [];
+  private readonly nodes = new Set<string>();
+
+  constructor(private readonly virtualNodes: number) {}
+
+  // ノードを追加
+  add(node: string): void {
+    if (this.nodes.has(node)) {
+      return;
+    }
+    this.nodes.add(node);
+    for (let i = 0; i < this.virtualNodes; i++) {
+      this.points.push({ hash: hash32(`${node}#${i}`), node });
+    }
+    this.points.sort((a, b) => a.hash - b.hash);
+  }
+
+  // ノードを削除
+  remove(node: string): void {
+    if (!this.nodes.delete(node)) {
+      return;
+    }
+    this.points = this.points.filter((point) => point.node !== node);
+  }
+
+  // キーを担当するノードを取得
+  lookup(key: string): string | undefined {
+    if (this.points.length === 0) {
+      return undefined;
+    }
+    const target = hash32(key);
+    // target以上の最初のポイントを二分探索
+    let low = 0;
+    let high = this.points.length;
+    while (low < high) {
+      const mid = (low + high) >>> 1;
+      if (this.points[mid].hash < target) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return this.points[low % this.points.length].node;
+  }
+
+  has(node: string): boolean {
+    return this.nodes.has(node);
+  }
+
+  get size(): number {
+    return this.nodes.size;
+  }
+}
+
+// バックエンドの状態
+interface Backend {
+  address: string;
+  host: string;
+  port: number;
+  healthy: boolean;
+  connections: number;
+  totalConnections: number;
+}
+
+const backends = new Map<string, Backend>();
+const ring = new HashRing(VIRTUAL_NODES);
+
+// バックエンドを登録
+function addBackend(address: string): void {
+  if (backends.has(address)) {
+    return;
+  }
+  const { host, port } = parseHostPort(address, 3000);
+  backends.set(address, {
+    address,
+    host,
+    port,
+    healthy: true,
+    connections: 0,
+    totalConnections: 0,
+  });
+  ring.add(address);
+  console.log(`バックエンド追加: ${address}`);
+}
+
+// バックエンドを削除
+function removeBackend(address: string): void {
+  if (backends.delete(address)) {
+    ring.remove(address);
+    console.log(`バックエンド削除: ${address}`);
+  }
+}
+
+// ヘルスチェック（/health に "ok" が返るか確認し、リングへの参加・離脱を反映）
+// 通常の接続と違い、バックエンドはセッションを作成・複製しない
+function checkBackend(backend: Backend): void {
+  const socket = net.connect(backend.port, backend.host);
+  socket.setTimeout(HEALTH_INTERVAL_MS);
+  let reply = "";
+  let checked = false;
+  const done = (healthy: boolean) => {
+    if (checked) {
+      return;
+    }
+    checked = true;
+    socket.destroy();
+    if (!backends.has(backend.address) || backend.healthy === healthy) {
+      return;
+    }
+    backend.healthy = healthy;
+    if (healthy) {
+      ring.add(backend.address);
+      console.log(`バックエンド復帰: ${backend.address}`);
+    } else {
+      ring.remove(backend.address);
+      console.log(`バックエンド離脱: ${backend.address}`);
+    }
+  };
+  socket.on("connect", () => socket.write("/health\n"));
+  socket.on("data", (data) => {
+    reply += data.toString("utf-8");
+    if (reply.includes("\n")) {
+      done(reply.trim() === "ok");
+    }
+  });
+  socket.on("end", () => done(reply.trim() === "ok"));
+  socket.on("timeout", () => done(false));
+  socket.on("error", () => done(false));
+}
+
+// 接続の振り分けキーを最初の行から決める
+function routingKey(firstLine: string, socket: net.Socket): string {
+  const match = /^\s*\/session\s+(\S+)/i.exec(firstLine);
+  if (match) {
+    return `session:${match[1]}`;
+  }
+  return `addr:${socket.remoteAddress}`;
+}
+
+// クライアント接続をバックエンドへ中継
+function relay(client: net.Socket, head: Buffer): void {
+  const newline = head.indexOf(0x0a);
+  const firstLine = head
+    .subarray(0, newline < 0 ? head.length : newline)
+    .toString("utf-8");
+  const address = ring.lookup(routingKey(firstLine, client));
+  const backend = address ? backends.get(address) : undefined;
+  if (!backend) {
+    console.error("利用可能なバックエンドがありません");
+    client.destroy();
+    return;
+  }
+
+  const upstream = net.connect(backend.port, backend.host);
+  upstream.setNoDelay(true);
+  backend.connections++;
+  backend.totalConnections++;
+
+  // 読み込み済みのデータを送ってから、双方向にそのまま流す
+  upstream.write(head);
+  client.pipe(upstream);
+  upstream.pipe(client);
+  client.resume();
+
+  const close = () => {
+    client.destroy();
+    upstream.destroy();
+  };
+  upstream.once("close", () => {
+    backend.connections--;
+    close();
+  });
+  client.once("close", close);
+  upstream.on("error", (err) => {
+    console.error(`バックエンドエラー (${backend.address}):`, err.message);
+  });
+  client.on("error", () => {});
+}
+
+// プロキシサーバー
+const server = net.createServer((client) => {
+  client.setNoDelay(true);
+  const chunks: Buffer[] = [];
+  let length = 0;
+
+  // 最初の行（または上限）まで溜めてから振り分ける
+  const onData = (data: Buffer) => {
+    chunks.push(data);
+    length += data.length;
+    if (data.includes(0x0a) || length >= MAX_FIRST_LINE) {
+      client.removeListener("data", onData);
+      client.pause();
+      relay(client, Buffer.concat(chunks, length));
+    }
+  };
+  client.on("data", onData);
+  client.on("error", () => client.destroy());
+});
+
+// 管理コマンド（add host:port / remove host:port / list）
+function handleAdminCommand(line: string): string {
+  const [command, address] = line.trim().split(/\s+/);
+  switch (command) {
+    case "add":
+      if (!address) {
+        return "error: address required";
+      }
+      addBackend(address);
+      return "ok";
+    case "remove":
+      if (!address) {
+        return "error: address required";
+      }
+      removeBackend(address);
+      return "ok";
+    case "list":
+      return [...backends.values()]
+        .map(
+          (b) =>
+            `${b.address} healthy=${b.healthy} active=${b.connections} total=${b.totalConnections}`
+        )
+        .join("\n");
+    default:
+      return "error: unknown command";
+  }
+}
+
+if (require.main === module) {
+  for (const address of BACKENDS) {
+    addBackend(address);
+  }
+
+  setInterval(() => {
+    for (const backend of backends.values()) {
+      checkBackend(backend);
+    }
+  }, HEALTH_INTERVAL_MS).unref();
+
+  server.listen(PORT, HOST, () => {
+    console.log(`プロキシが起動しました - ${HOST}:${PORT}`);
+    console.log(`バックエンド: ${BACKENDS.join(", ")}`);
+  });
+
+  if (ADMIN_PORT > 0) {
+    net
+      .createServer((socket) => {
+        let buffer = "";
+        socket.setEncoding("utf-8");
+        socket.on("data", (chunk: string) => {
+          buffer += chunk;
+          const lines = buffer.split("\n");
+          buffer = lines.pop() || "";
+          for (const line of lines) {
+            if (line.trim()) {
+              socket.write(`${handleAdminCommand(line)}\n`);
+            }
+          }
+        });
+        socket.on("error", () => socket.destroy());
+      })
+      .listen(ADMIN_PORT, "127.0.0.1", () => {
+        console.log(`管理ポート: 127.0.0.1:${ADMIN_PORT}`);
+      });
+  }
+
+  server.on("error", (err) => {
+    console.error("プロキシエラー:", err);
+  });
+}
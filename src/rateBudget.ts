@@ -0,0 +1,211 @@
+// 上流APIのレート制限（TPM / RPM）の予算管理
+//
+// 送信前にリクエストのトークン数を見積もり、モデルごとに直近1分間の使用量を
+// 数えて、アカウントの上限に達する前に送信を待たせるか、安価なモデルへ
+// 切り替える。429を受けてから待つと、その間は全ユーザーが止まるため。
+// 見積もりは送信時に予約し、応答の使用量が分かった時点で実績に置き換える。
+
+// 環境変数からの設定取得
+const DEFAULT_TPM = Number.parseInt(process.env.RATE_LIMIT_TPM || "0", 10); // 0の場合は制限しない
+const DEFAULT_RPM = Number.parseInt(process.env.RATE_LIMIT_RPM || "0", 10);
+const MODEL_LIMITS = process.env.RATE_LIMITS || ""; // "モデル=TPM/RPM,..." でモデルごとに指定
+const HEADROOM = Number.parseFloat(process.env.RATE_LIMIT_HEADROOM || "0.9"); // 上限のうち使う割合
+const FALLBACK_MODEL = process.env.RATE_LIMIT_FALLBACK_MODEL || ""; // 切り替え先のモデル
+const DOWNGRADE_AFTER_MS = Number.parseInt(
+  process.env.RATE_LIMIT_DOWNGRADE_AFTER_MS || "2000",
+  10
+); // これより長く待つ必要がある場合は切り替える
+const COMPLETION_ESTIMATE = Number.parseInt(
+  process.env.RATE_LIMIT_COMPLETION_ESTIMATE || "1024",
+  10
+); // 出力トークン数の上限が未指定の場合の見積もり
+
+const WINDOW_MS = 60000;
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// リクエストのトークン数の見積もり
+// UTF-8で日本語は1文字3バイト・約1トークン、英語は約4バイトで1トークンのため、
+// バイト数の1/3を上限寄りの見積もりとする。上流は出力の上限も予約するため加える。
+export function estimateTokens(
+  promptBytes: number,
+  maxCompletionTokens?: number
+): number {
+  return Math.ceil(promptBytes / 3) + (maxCompletionTokens || COMPLETION_ESTIMATE);
+}
+
+// 予約（実績が分かったら settle で置き換える）
+export interface Reservation {
+  settle(tokens: number): void;
+}
+
+// 1モデル分のスライディングウィンドウ
+class RateBudget {
+  private readonly entries: { at: number; tokens: number }[] = [];
+  delayed = 0;
+  downgraded = 0;
+  waitedMs = 0;
+
+  constructor(
+    readonly tpm: number,
+    readonly rpm: number
+  ) {}
+
+  // 送信できるまでの待ち時間（0なら即時）
+  waitTime(tokens: number, now = Date.now()): number {
+    this.purge(now);
+    const tokenLimit = this.tpm * HEADROOM;
+    const requestLimit = Math.max(1, Math.floor(this.rpm * HEADROOM));
+    let usedTokens = this.usedTokens();
+    let usedRequests = this.entries.length;
+
+    const fits = () =>
+      (this.tpm <= 0 || usedTokens + tokens <= tokenLimit || usedTokens === 0) &&
+      (this.rpm <= 0 || usedRequests + 1 <= requestLimit);
+    if (fits()) {
+      return 0;
+    }
+
+    // 古い予約が期限切れになって収まる時刻を求める
+    for (const entry of this.entries) {
+      usedTokens -= entry.tokens;
+      usedRequests--;
+      if (fits()) {
+        return Math.max(1, entry.at + WINDOW_MS - now);
+      }
+    }
+    return 1;
+  }
+
+  // 予約を記録
+  reserve(tokens: number): Reservation {
+    const entry = { at: Date.now(), tokens };
+    this.entries.push(entry);
+    return {
+      settle(actual: number) {
+        entry.tokens = actual;
+      },
+    };
+  }
+
+  // 統計情報
+  stats(): Record<string, number> {
+    this.purge(Date.now());
+    const usedTokens = this.usedTokens();
+    return {
+      tpm_used: usedTokens,
+      tpm_limit: this.tpm,
+      rpm_used: this.entries.length,
+      rpm_limit: this.rpm,
+      tokens_headroom:
+        this.tpm > 0 ? Math.max(0, Math.floor(this.tpm * HEADROOM) - usedTokens) : -1,
+      requests_headroom:
+        this.rpm > 0
+          ? Math.max(0, Math.floor(this.rpm * HEADROOM) - this.entries.length)
+          : -1,
+      delayed: this.delayed,
+      downgraded: this.downgraded,
+      waited_ms: this.waitedMs,
+    };
+  }
+
+  private usedTokens(): number {
+    let total = 0;
+    for (const entry of this.entries) {
+      total += entry.tokens;
+    }
+    return total;
+  }
+
+  private purge(now: number): void {
+    while (this.entries.length > 0 && this.entries[0].at <= now - WINDOW_MS) {
+      this.entries.shift();
+    }
+  }
+}
+
+// 予算の確保結果
+export interface Admission {
+  model: string; // 実際に使うモデル（切り替えた場合は切り替え先）
+  reservation: Reservation | null;
+}
+
+// モデルごとの予算
+export class RateLimiter {
+  private readonly budgets = new Map<string, RateBudget | null>();
+  private readonly limits = new Map<string, { tpm: number; rpm: number }>();
+
+  constructor() {
+    for (const item of MODEL_LIMITS.split(",")) {
+      const match = /^\s*([^=\s]+)\s*=\s*(\d+)\s*\/\s*(\d+)\s*$/.exec(item);
+      if (match) {
+        this.limits.set(match[1], {
+          tpm: Number.parseInt(match[2], 10),
+          rpm: Number.parseInt(match[3], 10),
+        });
+        this.budget(match[1]);
+      }
+    }
+  }
+
+  // 送信前に予算を確保する
+  // 待ち時間が短ければ待ち、長ければ切り替え先のモデルに余裕があれば切り替える
+  async acquire(model: string, tokens: number): Promise<Admission> {
+    const budget = this.budget(model);
+    if (!budget) {
+      return { model, reservation: null };
+    }
+
+    let counted = false;
+    for (;;) {
+      const wait = budget.waitTime(tokens);
+      if (wait === 0) {
+        return { model, reservation: budget.reserve(tokens) };
+      }
+
+      const fallback =
+        FALLBACK_MODEL && FALLBACK_MODEL !== model
+          ? this.budget(FALLBACK_MODEL)
+          : undefined;
+      if (wait > DOWNGRADE_AFTER_MS && fallback !== undefined) {
+        if (!fallback || fallback.waitTime(tokens) === 0) {
+          budget.downgraded++;
+          return {
+            model: FALLBACK_MODEL,
+            reservation: fallback ? fallback.reserve(tokens) : null,
+          };
+        }
+      }
+
+      if (!counted) {
+        budget.delayed++;
+        counted = true;
+      }
+      const step = Math.min(wait, 1000);
+      budget.waitedMs += step;
+      await sleep(step);
+    }
+  }
+
+  // 統計情報（制限を設定したモデルのみ）
+  stats(): Record<string, Record<string, number>> {
+    const result: Record<string, Record<string, number>> = {};
+    for (const [model, budget] of this.budgets) {
+      if (budget) {
+        result[model] = budget.stats();
+      }
+    }
+    return result;
+  }
+
+  private budget(model: string): RateBudget | null {
+    let budget = this.budgets.get(model);
+    if (budget === undefined) {
+      const limit = this.limits.get(model) || { tpm: DEFAULT_TPM, rpm: DEFAULT_RPM };
+      budget =
+        limit.tpm > 0 || limit.rpm > 0 ? new RateBudget(limit.tpm, limit.rpm) : null;
+      this.budgets.set(model, budget);
+    }
+    return budget;
+  }
+}
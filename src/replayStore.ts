@@ -0,0 +1,89 @@
+// 冪等キーごとのレスポンス保持
+//
+// 応答の送信中に接続が切れた場合、クライアントは同じキーで再送する。
+// 保持期間内であれば保存済みのフレームを返し（必要なら途中のバイト位置から）、
+// 上流APIへの再リクエストを避ける。生成中のキーへの再送は同じ結果を待つ。
+
+// 保持エントリ
+interface ReplayEntry {
+  frame: Promise<Uint8Array>;
+  size: number;
+  expiresAt: number;
+}
+
+export class ReplayStore {
+  private readonly entries = new Map<string, ReplayEntry>();
+  private totalBytes = 0;
+
+  constructor(
+    private readonly retentionMs: number,
+    private readonly maxBytes: number
+  ) {}
+
+  // 保存済み（または生成中）のフレームを取得
+  get(key: string): Promise<Uint8Array> | undefined {
+    this.purge();
+    return this.entries.get(key)?.frame;
+  }
+
+  // 生成中のフレームを登録し、完了後に保持期間を開始する
+  set(key: string, frame: Promise<Uint8Array>): void {
+    this.delete(key);
+    const entry: ReplayEntry = {
+      frame,
+      size: 0,
+      expiresAt: Number.POSITIVE_INFINITY,
+    };
+    this.entries.set(key, entry);
+
+    frame.then(
+      (bytes) => {
+        if (this.entries.get(key) !== entry) {
+          return;
+        }
+        // 完了時刻から保持期間を数えるため、末尾に入れ直す
+        this.entries.delete(key);
+        this.entries.set(key, entry);
+        entry.size = bytes.byteLength;
+        entry.expiresAt = Date.now() + this.retentionMs;
+        this.totalBytes += entry.size;
+        this.purge();
+      },
+      () => {
+        if (this.entries.get(key) === entry) {
+          this.entries.delete(key);
+        }
+      }
+    );
+  }
+
+  // エントリを削除
+  delete(key: string): void {
+    const entry = this.entries.get(key);
+    if (entry) {
+      this.totalBytes -= entry.size;
+      this.entries.delete(key);
+    }
+  }
+
+  // 保持数
+  get size(): number {
+    return this.entries.size;
+  }
+
+  // 期限切れ・容量超過のエントリを古い順に削除
+  private purge(): void {
+    const now = Date.now();
+    for (const [key, entry] of this.entries) {
+      if (entry.expiresAt === Number.POSITIVE_INFINITY) {
+        // 生成中のエントリは対象外
+        continue;
+      }
+      if (entry.expiresAt > now && this.totalBytes <= this.maxBytes) {
+        break;
+      }
+      this.totalBytes -= entry.size;
+      this.entries.delete(key);
+    }
+  }
+}
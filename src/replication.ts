@@ -0,0 +1,273 @@
+import * as net from "node:net";
+import type { GenerationSettings } from "./generationSettings";
+import { logger } from "./logger";
+
+// セッションレプリケーション
+//
+// プライマリはセッション状態の変更（追加・クリア・モデル変更・設定変更・削除）と
+// 冪等キー付きの応答を
+// 1行1イベントのJSONとしてTCPでスタンバイへ送る。接続時にはまず全セッションの
+// スナップショットを送るため、スタンバイは途中から参加しても同じ状態になる。
+// スタンバイは適用したイベントの通番を返し、プライマリはそれで遅延を測る。
+
+// セッション状態の変更
+export type SessionMutation =
+  | { op: "init"; session: string }
+  | {
+      op: "append";
+      session: string;
+      role: "user" | "assistant";
+      content: string;
+    }
+  | { op: "model"; session: string; model: string }
+  | { op: "settings"; session: string; settings: GenerationSettings }
+  | { op: "drop"; session: string }
+  // 冪等キー付きの応答（フェイルオーバー後の再送で同じ応答を返すため）
+  | { op: "replay"; session: string; key: string; frame: string }; // frame は base64
+
+// スナップショット中の1セッション
+export interface SessionSnapshot {
+  session: string;
+  model: string;
+  settings?: GenerationSettings;
+  messages: { role: string; content: string }[];
+}
+
+// 回線上のイベント
+type ReplicationEvent =
+  | { type: "snapshot"; seq: number; ts: number; sessions: SessionSnapshot[] }
+  | { type: "mutation"; seq: number; ts: number; mutation: SessionMutation };
+
+// 再接続の間隔
+const RECONNECT_DELAY_MS = 1000;
+
+// ACK待ちとして保持するイベント数の上限
+const MAX_UNACKED = 10000;
+
+// "host:port" を分解
+export function parseHostPort(
+  value: string,
+  defaultPort: number
+): { host: string; port: number } {
+  const index = value.lastIndexOf(":");
+  if (index < 0) {
+    return { host: value, port: defaultPort };
+  }
+  return {
+    host: value.substring(0, index) || "127.0.0.1",
+    port: Number.parseInt(value.substring(index + 1), 10) || defaultPort,
+  };
+}
+
+// 改行区切りJSONの受信
+function onJsonLines(
+  socket: net.Socket,
+  handler: (value: unknown) => void
+): void {
+  let buffer = "";
+  socket.setEncoding("utf-8");
+  socket.on("data", (chunk: string) => {
+    buffer += chunk;
+    let index = buffer.indexOf("\n");
+    while (index >= 0) {
+      const line = buffer.substring(0, index);
+      buffer = buffer.substring(index + 1);
+      if (line) {
+        try {
+          handler(JSON.parse(line));
+        } catch (error) {
+          logger.warn("replication", "不正なイベント", { error });
+        }
+      }
+      index = buffer.indexOf("\n");
+    }
+  });
+}
+
+// プライマリ側: スタンバイへ変更を送信する
+export class ReplicationPrimary {
+  private socket: net.Socket | null = null;
+  private connected = false;
+  private seq = 0;
+  private readonly unacked = new Map<number, number>();
+  private eventsSent = 0;
+  private bytesSent = 0;
+  private lastLagMs = 0;
+  private maxLagMs = 0;
+  private readonly startedAt = Date.now();
+
+  constructor(
+    private readonly host: string,
+    private readonly port: number,
+    private readonly snapshot: () => SessionSnapshot[]
+  ) {}
+
+  // 接続を開始（切断時は自動で再接続）
+  start(): void {
+    const socket = net.connect(this.port, this.host);
+    this.socket = socket;
+    socket.setNoDelay(true);
+
+    socket.on("connect", () => {
+      this.connected = true;
+      this.unacked.clear();
+      logger.info("replication", "レプリケーション接続", {
+        target: `${this.host}:${this.port}`,
+      });
+      this.send({
+        type: "snapshot",
+        seq: ++this.seq,
+        ts: Date.now(),
+        sessions: this.snapshot(),
+      });
+    });
+
+    onJsonLines(socket, (value) => {
+      const ack = (value as { ack?: number }).ack;
+      if (typeof ack === "number") {
+        this.acknowledge(ack);
+      }
+    });
+
+    socket.on("error", (err) => {
+      logger.warn("replication", "レプリケーションエラー", { error: err });
+    });
+
+    socket.on("close", () => {
+      if (this.connected) {
+        logger.info("replication", "レプリケーション切断");
+      }
+      this.connected = false;
+      this.socket = null;
+      setTimeout(() => this.start(), RECONNECT_DELAY_MS).unref();
+    });
+  }
+
+  // 変更を送信（未接続の場合は次回接続時のスナップショットに含まれる）
+  publish(mutation: SessionMutation): void {
+    if (!this.connected) {
+      return;
+    }
+    this.send({ type: "mutation", seq: ++this.seq, ts: Date.now(), mutation });
+  }
+
+  // 統計情報
+  stats(): Record<string, number | boolean> {
+    const elapsedSec = (Date.now() - this.startedAt) / 1000;
+    return {
+      connected: this.connected,
+      last_seq: this.seq,
+      events_sent: this.eventsSent,
+      bytes_sent: this.bytesSent,
+      events_per_sec: Math.round((this.eventsSent / elapsedSec) * 100) / 100,
+      unacked: this.unacked.size,
+      lag_ms: this.lastLagMs,
+      max_lag_ms: this.maxLagMs,
+    };
+  }
+
+  private send(event: ReplicationEvent): void {
+    if (!this.socket) {
+      return;
+    }
+    const line = `${JSON.stringify(event)}\n`;
+    this.socket.write(line);
+    this.eventsSent++;
+    this.bytesSent += Buffer.byteLength(line);
+    if (this.unacked.size < MAX_UNACKED) {
+      this.unacked.set(event.seq, event.ts);
+    }
+  }
+
+  // ACKを受け取った通番までを確定し、遅延を記録
+  private acknowledge(ack: number): void {
+    const sentAt = this.unacked.get(ack);
+    if (sentAt !== undefined) {
+      this.lastLagMs = Date.now() - sentAt;
+      this.maxLagMs = Math.max(this.maxLagMs, this.lastLagMs);
+    }
+    for (const seq of this.unacked.keys()) {
+      if (seq > ack) {
+        break;
+      }
+      this.unacked.delete(seq);
+    }
+  }
+}
+
+// スタンバイ側: プライマリから変更を受信して適用する
+export class ReplicationStandby {
+  private server: net.Server | null = null;
+  private primaryConnected = false;
+  private lastSeq = 0;
+  private eventsApplied = 0;
+  private bytesReceived = 0;
+  private lastApplyLagMs = 0;
+  private lastEventAt = 0;
+
+  constructor(
+    private readonly host: string,
+    private readonly port: number,
+    private readonly onSnapshot: (sessions: SessionSnapshot[]) => void,
+    private readonly onMutation: (mutation: SessionMutation) => void,
+    private readonly onDisconnect: () => void = () => {}
+  ) {}
+
+  // 受信を開始
+  start(): void {
+    this.server = net.createServer((socket) => {
+      logger.info("replication", "プライマリ接続", {
+        primary: `${socket.remoteAddress}:${socket.remotePort}`,
+      });
+      this.primaryConnected = true;
+      socket.setNoDelay(true);
+
+      socket.on("data", (data: Buffer | string) => {
+        this.bytesReceived += Buffer.byteLength(data);
+      });
+
+      onJsonLines(socket, (value) => {
+        const event = value as ReplicationEvent;
+        if (event.type === "snapshot") {
+          this.onSnapshot(event.sessions);
+        } else if (event.type === "mutation") {
+          this.onMutation(event.mutation);
+        }
+        this.lastSeq = event.seq;
+        this.eventsApplied++;
+        this.lastEventAt = Date.now();
+        this.lastApplyLagMs = this.lastEventAt - event.ts;
+        socket.write(`${JSON.stringify({ ack: event.seq })}\n`);
+      });
+
+      socket.on("error", (err) => {
+        logger.warn("replication", "レプリケーションエラー", { error: err });
+      });
+
+      socket.on("close", () => {
+        logger.info("replication", "プライマリ切断");
+        this.primaryConnected = false;
+        this.onDisconnect();
+      });
+    });
+
+    this.server.listen(this.port, this.host, () => {
+      logger.info(
+        "replication",
+        `レプリケーション受信を開始しました - ${this.host}:${this.port}`
+      );
+    });
+  }
+
+  // 統計情報
+  stats(): Record<string, number | boolean> {
+    return {
+      primary_connected: this.primaryConnected,
+      last_seq: this.lastSeq,
+      events_applied: this.eventsApplied,
+      bytes_received: this.bytesReceived,
+      apply_lag_ms: this.lastApplyLagMs,
+      idle_ms: this.lastEventAt ? Date.now() - this.lastEventAt : 0,
+    };
+  }
+}
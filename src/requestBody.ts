@@ -0,0 +1,49 @@
+// 上流APIへのリクエストボディの組み立て
+//
+// 会話履歴の各メッセージは、履歴に追加した時点で一度だけJSONに変換して
+// バイト列（セグメント）として保持する。リクエストごとの処理はセグメントを
+// 連結するだけになり、シリアライズのコストは履歴全体ではなく新しいメッセージ
+// の分だけになる。結果は JSON.stringify({ ...head, messages }) と同じバイト列。
+
+const encoder = new TextEncoder();
+const COMMA = 0x2c; // ","
+const SUFFIX = encoder.encode("]}");
+
+// 1メッセージ分のセグメント
+export function encodeMessageSegment(message: unknown): Uint8Array {
+  return encoder.encode(JSON.stringify(message));
+}
+
+// messages 以外の項目とセグメントからリクエストボディを組み立てる
+// SDKは ArrayBuffer.isView を満たすボディだけをそのまま送信する（ArrayBuffer は
+// JSONに変換されて "{}" になる）ため、Uint8Arrayのまま返す
+export function buildRequestBody(
+  head: Record<string, unknown>,
+  segments: Uint8Array[]
+): Uint8Array {
+  const fields = JSON.stringify(head);
+  const prefix = encoder.encode(
+    `${fields.substring(0, fields.length - 1)}${
+      fields.length > 2 ? "," : ""
+    }"messages":[`
+  );
+
+  let size = prefix.byteLength + SUFFIX.byteLength;
+  for (const segment of segments) {
+    size += segment.byteLength;
+  }
+  size += Math.max(0, segments.length - 1);
+
+  const body = new Uint8Array(size);
+  body.set(prefix, 0);
+  let offset = prefix.byteLength;
+  for (let i = 0; i < segments.length; i++) {
+    if (i > 0) {
+      body[offset++] = COMMA;
+    }
+    body.set(segments[i], offset);
+    offset += segments[i].byteLength;
+  }
+  body.set(SUFFIX, offset);
+  return body;
+}
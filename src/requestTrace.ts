@@ -0,0 +1,217 @@
+import { randomBytes } from "node:crypto";
+import * as fs from "node:fs";
+import { performance } from "node:perf_hooks";
+
+// リクエストのトレース（クライアント → サーバー → 上流）
+//
+// 遅い応答の原因がどの区間にあるかを1件ずつ確認できるよう、リクエストごとの
+// トレースIDで区間（スパン）を記録する。トレースIDはクライアントが @trace=
+// （W3C Trace Context と同じ32桁の16進数）で送り、ない場合はサーバーが生成する。
+// 上流へは traceparent ヘッダーで引き継ぐ。
+//
+// スパンは TRACE_FILE に Chrome の Trace Event 形式（JSON配列）で追記し、
+// chrome://tracing や Perfetto（ui.perfetto.dev）でタイムラインとして表示できる。
+// 1リクエストが1行（tid）になり、行名にトレースIDの先頭を表示する。
+
+// 環境変数からの設定取得
+const TRACE_FILE = process.env.TRACE_FILE || ""; // 未指定の場合は記録しない
+const TRACE_SAMPLE = Number.parseFloat(process.env.TRACE_SAMPLE || "1"); // 記録する割合
+
+const TRACE_ID_PATTERN = /^[0-9a-f]{32}$/;
+
+// Trace Event 形式のイベント
+interface TraceEvent {
+  name: string;
+  cat: string;
+  ph: "X" | "i" | "M";
+  ts: number; // マイクロ秒
+  dur?: number;
+  pid: number;
+  tid: number;
+  s?: "t";
+  args: Record<string, unknown>;
+}
+
+// 記録先（最初の書き込みで開き、新しいファイルなら配列の開始を書く）
+let output: fs.WriteStream | null = null;
+let lastLane = 0;
+let sampled = 0;
+let skipped = 0;
+let spansWritten = 0;
+
+function open(): fs.WriteStream {
+  if (!output) {
+    let size = 0;
+    try {
+      size = fs.statSync(TRACE_FILE).size;
+    } catch {
+      // 新しいファイル
+    }
+    output = fs.createWriteStream(TRACE_FILE, { flags: "a" });
+    // 配列の閉じ括弧は省略できる（追記を続けられるよう書かない）
+    if (size === 0) {
+      output.write("[\n");
+    }
+  }
+  return output;
+}
+
+// performance.now() のミリ秒を UNIX時間のマイクロ秒に変換
+function toMicros(ms: number): number {
+  return Math.round((performance.timeOrigin + ms) * 1000);
+}
+
+function newSpanId(): string {
+  return randomBytes(8).toString("hex");
+}
+
+// 記録するかどうか（トレースIDから決めるため、同じIDなら常に同じ結果）
+function shouldSample(traceId: string): boolean {
+  if (!TRACE_FILE || TRACE_SAMPLE <= 0) {
+    return false;
+  }
+  return (
+    TRACE_SAMPLE >= 1 ||
+    Number.parseInt(traceId.substring(24), 16) / 0x100000000 < TRACE_SAMPLE
+  );
+}
+
+// 1区間（end を呼ぶまで）
+export class Span {
+  readonly id = newSpanId();
+  private readonly start = performance.now();
+  private ended = false;
+
+  constructor(
+    private readonly trace: RequestTrace,
+    readonly name: string,
+    private readonly parentId: string | null
+  ) {}
+
+  end(args: Record<string, unknown> = {}): void {
+    if (this.ended) {
+      return;
+    }
+    this.ended = true;
+    this.trace.record(this.name, this.start, performance.now(), {
+      span_id: this.id,
+      parent_id: this.parentId ?? undefined,
+      ...args,
+    });
+  }
+}
+
+// 1リクエスト分のトレース
+export class RequestTrace {
+  readonly traceId: string;
+  readonly sampled: boolean;
+  readonly root: Span;
+  private readonly events: TraceEvent[] = [];
+  private readonly lane: number;
+
+  // clientTraceId は @trace の値（不正な値や未指定の場合は生成する）
+  constructor(
+    clientTraceId: string | undefined,
+    private readonly fields: Record<string, unknown>
+  ) {
+    this.traceId =
+      clientTraceId &&
+      TRACE_ID_PATTERN.test(clientTraceId) &&
+      !/^0+$/.test(clientTraceId)
+        ? clientTraceId
+        : randomBytes(16).toString("hex");
+    this.sampled = shouldSample(this.traceId);
+    this.lane = ++lastLane;
+    if (this.sampled) {
+      sampled++;
+    } else {
+      skipped++;
+    }
+    this.root = new Span(this, "request", null);
+  }
+
+  // リクエスト全体の下に区間を開始
+  begin(name: string): Span {
+    return new Span(this, name, this.root.id);
+  }
+
+  // 時点のイベント（最初のトークンの受信など）
+  mark(name: string, args: Record<string, unknown> = {}): void {
+    if (!this.sampled) {
+      return;
+    }
+    this.events.push({
+      name,
+      cat: "server",
+      ph: "i",
+      s: "t",
+      ts: toMicros(performance.now()),
+      pid: process.pid,
+      tid: this.lane,
+      args: { trace_id: this.traceId, ...args },
+    });
+  }
+
+  // 上流へのリクエストに付ける traceparent ヘッダー
+  traceparent(span: Span): string {
+    return `00-${this.traceId}-${span.id}-${this.sampled ? "01" : "00"}`;
+  }
+
+  record(
+    name: string,
+    start: number,
+    end: number,
+    args: Record<string, unknown>
+  ): void {
+    if (!this.sampled) {
+      return;
+    }
+    this.events.push({
+      name,
+      cat: "server",
+      ph: "X",
+      ts: toMicros(start),
+      dur: Math.max(0, Math.round((end - start) * 1000)),
+      pid: process.pid,
+      tid: this.lane,
+      args: { trace_id: this.traceId, ...args },
+    });
+  }
+
+  // リクエスト全体の区間を閉じ、まとめて書き出す
+  finish(args: Record<string, unknown> = {}): void {
+    this.root.end({ ...this.fields, ...args });
+    if (!this.sampled || this.events.length === 0) {
+      return;
+    }
+    const metadata: TraceEvent = {
+      name: "thread_name",
+      cat: "__metadata",
+      ph: "M",
+      ts: 0,
+      pid: process.pid,
+      tid: this.lane,
+      args: { name: `${this.traceId.substring(0, 8)} ${this.fields.session}` },
+    };
+    const lines = [metadata, ...this.events].map(
+      (event) => `${JSON.stringify(event)},\n`
+    );
+    open().write(lines.join(""));
+    spansWritten += this.events.length;
+    this.events.length = 0;
+  }
+}
+
+// 統計情報（記録しない場合は null）
+export function requestTraceStats(): Record<string, number | string> | null {
+  if (!TRACE_FILE) {
+    return null;
+  }
+  return {
+    file: TRACE_FILE,
+    sample: TRACE_SAMPLE,
+    sampled,
+    skipped,
+    spans: spansWritten,
+  };
+}
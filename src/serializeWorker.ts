@@ -0,0 +1,40 @@
+import { parentPort } from "node:worker_threads";
+import type { FrameFormat } from "./outputEncoding";
+import {
+  encodeFrame,
+  encodeXmlFrame,
+  toExactArrayBuffer,
+} from "./serializer";
+
+// シリアライズ用ワーカースレッド
+// メインスレッドから受け取ったデータをバイト列に変換し、転送で返す
+parentPort?.on(
+  "message",
+  (message: { id: number; type: string; payload: unknown }) => {
+    try {
+      let bytes: Uint8Array;
+      switch (message.type) {
+        case "xml":
+          bytes = encodeXmlFrame(message.payload);
+          break;
+        case "frame": {
+          const { data, format } = message.payload as {
+            data: unknown;
+            format: FrameFormat;
+          };
+          bytes = encodeFrame(data, format);
+          break;
+        }
+        default:
+          throw new Error(`不明なタスク: ${message.type}`);
+      }
+      const buffer = toExactArrayBuffer(bytes);
+      parentPort?.postMessage({ id: message.id, buffer }, [buffer]);
+    } catch (error) {
+      parentPort?.postMessage({
+        id: message.id,
+        error: error instanceof Error ? error.message : String(error),
+      });
+    }
+  }
+);
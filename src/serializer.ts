@@ -0,0 +1,123 @@
+import * as path from "node:path";
+import { XMLBuilder } from "fast-xml-parser";
+import {
+  DEFAULT_FORMAT,
+  type FrameFormat,
+  buildPlainFrame,
+  encodeText,
+} from "./outputEncoding";
+import { logger } from "./logger";
+import { WorkerPool } from "./workerPool";
+
+// この文字数を超えるペイロードはワーカースレッドでシリアライズする
+export const OFFLOAD_THRESHOLD = Number.parseInt(
+  process.env.SERIALIZE_OFFLOAD_THRESHOLD || "65536",
+  10
+);
+
+// ワーカースレッド数（0の場合はオフロードを無効化）
+const WORKER_COUNT = Number.parseInt(
+  process.env.SERIALIZE_WORKERS || "2",
+  10
+);
+
+// XMLビルダーの設定（メインスレッドとワーカーで共通）
+export const xmlBuilderOptions = {
+  format: true,
+  ignoreAttributes: false,
+};
+
+const xmlBuilder = new XMLBuilder(xmlBuilderOptions);
+const encoder = new TextEncoder();
+
+// ワーカープール（初回のオフロード時に生成）
+let pool: WorkerPool | null = null;
+
+function getPool(): WorkerPool | null {
+  if (WORKER_COUNT <= 0) {
+    return null;
+  }
+  if (!pool) {
+    pool = new WorkerPool(
+      path.join(__dirname, "serializeWorker.ts"),
+      WORKER_COUNT
+    );
+  }
+  return pool;
+}
+
+// ペイロードに含まれる文字列のおおよその長さを求める
+export function approximateSize(value: unknown): number {
+  if (typeof value === "string") {
+    return value.length;
+  }
+  if (Array.isArray(value)) {
+    let size = 0;
+    for (const item of value) {
+      size += approximateSize(item);
+    }
+    return size;
+  }
+  if (value !== null && typeof value === "object") {
+    let size = 0;
+    for (const item of Object.values(value)) {
+      size += approximateSize(item);
+    }
+    return size;
+  }
+  return 8;
+}
+
+// XMLフレーム（XML本体＋終端の改行）をバイト列として生成
+export function encodeXmlFrame(data: unknown): Uint8Array {
+  return encoder.encode(`${xmlBuilder.build(data)}\n`);
+}
+
+// 接続ごとの形式（文字コード・plain 形式）でフレームを生成
+export function encodeFrame(data: unknown, format: FrameFormat): Uint8Array {
+  if (format.plain) {
+    return buildPlainFrame(data, format.encoding);
+  }
+  if (format.encoding === "utf-8") {
+    return encodeXmlFrame(data);
+  }
+  return encodeText(`${xmlBuilder.build(data)}\n`, format.encoding);
+}
+
+// クライアントへ送信するXMLフレームを生成
+// 大きなレスポンスはワーカースレッドで生成し、イベントループを塞がない
+// （文字コードの変換もワーカーで行う）
+export async function buildResponseFrame(
+  data: unknown,
+  threshold = OFFLOAD_THRESHOLD,
+  format: FrameFormat = DEFAULT_FORMAT
+): Promise<Uint8Array> {
+  const workers = approximateSize(data) > threshold ? getPool() : null;
+  const plainUtf8 = format.encoding === "utf-8" && !format.plain;
+  if (!workers) {
+    return plainUtf8 ? encodeXmlFrame(data) : encodeFrame(data, format);
+  }
+  try {
+    return await (plainUtf8
+      ? workers.run({ type: "xml", payload: data })
+      : workers.run({ type: "frame", payload: { data, format } }));
+  } catch (error) {
+    // ワーカーのエラーや異常終了ではメインスレッドで生成し直す
+    logger.warn("serialize", "ワーカーで生成できないためメインスレッドで生成", {
+      error,
+    });
+    return encodeFrame(data, format);
+  }
+}
+
+// Uint8Arrayが参照する範囲だけを持つArrayBufferを得る（ワーカーからの転送用）
+export function toExactArrayBuffer(bytes: Uint8Array): ArrayBuffer {
+  if (
+    bytes.byteOffset === 0 &&
+    bytes.byteLength === bytes.buffer.byteLength &&
+    bytes.buffer instanceof ArrayBuffer
+  ) {
+    return bytes.buffer;
+  }
+  return bytes.slice().buffer as ArrayBuffer;
+}
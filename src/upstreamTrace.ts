@@ -0,0 +1,298 @@
+import { createHash } from "node:crypto";
+import * as fs from "node:fs";
+import * as zlib from "node:zlib";
+import { fetch as sdkFetch } from "openai/_shims/index";
+
+// 上流APIの通信の記録と再生
+//
+// 上流の応答時間と出力は毎回異なるため、サーバーの性能を実行ごとに比較できない。
+// 記録モードでは上流へのリクエストと応答（ストリーミングの各チャンクの到着時刻を
+// 含む）をトレースファイルに書き出し、再生モードでは上流に接続せずに、記録した
+// 応答を元の時間（または倍率をかけた時間）で返す。SDKの fetch を差し替えるため、
+// フレーム生成・スケジューリング・キャッシュ・履歴処理はそのまま動く。
+// 記録時の送信はSDK標準の fetch で行い、バックエンドごとの keep-alive の
+// エージェント（httpAgent）をそのまま使う。
+//
+// トレースは1行1往復のJSONL（.gz で終わる場合はgzip圧縮）:
+//   { "method", "path", "hash"（リクエストボディのSHA-1）, "status", "type",
+//     "ttfb"（ヘッダー受信までのミリ秒）, "chunks": [[経過ミリ秒, "本文"], ...] }
+//
+// 再生時は同じメソッド・パス・ボディのものを記録順に使い、なければ同じパスの
+// ものを順番に使う（負荷試験でプロンプトが異なる場合）。
+
+// 環境変数からの設定取得
+const RECORD_PATH = process.env.UPSTREAM_RECORD || ""; // 記録先
+const REPLAY_PATH = process.env.UPSTREAM_REPLAY || ""; // 再生するトレース
+const TIME_SCALE = Number.parseFloat(
+  process.env.UPSTREAM_REPLAY_TIME_SCALE || "1"
+); // 再生時の時間の倍率（0の場合は待たずに返す）
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// 記録時の間隔に倍率をかけて待つ（0以下なら待たない）
+async function pause(ms: number): Promise<void> {
+  if (ms * TIME_SCALE > 0) {
+    await sleep(ms * TIME_SCALE);
+  }
+}
+
+// SDKに渡す fetch
+export type FetchFunction = (
+  url: string | URL | Request,
+  init?: RequestInit
+) => Promise<Response>;
+
+// 1往復分の記録
+interface TraceEntry {
+  method: string;
+  path: string;
+  hash: string;
+  status: number;
+  type: string;
+  ttfb: number;
+  chunks: [number, string][];
+}
+
+// リクエストの識別（ホストを除いたパスと、ボディのハッシュ）
+function requestKey(
+  url: string | URL | Request,
+  init?: RequestInit
+): { method: string; path: string; hash: string } {
+  const parsed = new URL(typeof url === "string" ? url : url.toString());
+  const body = init?.body;
+  const hash = createHash("sha1");
+  if (typeof body === "string") {
+    hash.update(body);
+  } else if (body instanceof ArrayBuffer) {
+    hash.update(new Uint8Array(body));
+  } else if (ArrayBuffer.isView(body)) {
+    hash.update(
+      new Uint8Array(body.buffer, body.byteOffset, body.byteLength)
+    );
+  }
+  // ストリームのボディ（ファイルのアップロード）はパスのみで照合する
+  return {
+    method: (init?.method || "GET").toUpperCase(),
+    path: `${parsed.pathname}${parsed.search}`,
+    hash: hash.digest("hex"),
+  };
+}
+
+// 記録モード：応答をそのまま中継しながら、チャンクと到着時刻を書き出す
+class TraceRecorder {
+  private readonly file: fs.WriteStream;
+  private readonly gzip: zlib.Gzip | null = null;
+  recorded = 0;
+
+  constructor(path: string) {
+    this.file = fs.createWriteStream(path);
+    if (path.endsWith(".gz")) {
+      this.gzip = zlib.createGzip();
+      this.gzip.pipe(this.file);
+    }
+    // イベントループが空になったら閉じる（シグナルで終了した場合も、
+    // 1往復ごとにフラッシュしているため途中までは読める）
+    process.once("beforeExit", () => (this.gzip || this.file).end());
+  }
+
+  readonly fetch: FetchFunction = async (url, init) => {
+    const key = requestKey(url, init);
+    const startedAt = Date.now();
+    // グローバルの fetch は init.agent を無視して接続プールを使わないため、
+    // SDK標準の fetch（エージェントに対応）で送信する
+    const response = (await sdkFetch(
+      url as Parameters<typeof sdkFetch>[0],
+      init as Parameters<typeof sdkFetch>[1]
+    )) as unknown as Response;
+    const entry: TraceEntry = {
+      ...key,
+      status: response.status,
+      type: response.headers.get("content-type") || "",
+      ttfb: Date.now() - startedAt,
+      chunks: [],
+    };
+    if (!response.body) {
+      this.write(entry);
+      return response;
+    }
+
+    // 受信したチャンクをすぐに渡しつつ、到着時刻とともに記録する
+    // （SDK標準の fetch のボディはNodeのストリームのため、反復で読む）
+    const reader = (response.body as unknown as AsyncIterable<Uint8Array>)[
+      Symbol.asyncIterator
+    ]();
+    const decoder = new TextDecoder();
+    const tee = new ReadableStream<Uint8Array>({
+      pull: async (controller) => {
+        try {
+          const { done, value } = await reader.next();
+          if (done) {
+            const rest = decoder.decode();
+            if (rest) {
+              entry.chunks.push([Date.now() - startedAt, rest]);
+            }
+            this.write(entry);
+            controller.close();
+            return;
+          }
+          entry.chunks.push([
+            Date.now() - startedAt,
+            decoder.decode(value, { stream: true }),
+          ]);
+          controller.enqueue(value);
+        } catch (error) {
+          controller.error(error);
+        }
+      },
+      cancel: async () => {
+        await reader.return?.();
+      },
+    });
+    return new Response(tee, {
+      status: response.status,
+      statusText: response.statusText,
+      headers: [...response.headers],
+    });
+  };
+
+  private write(entry: TraceEntry): void {
+    const line = `${JSON.stringify(entry)}\n`;
+    if (this.gzip) {
+      this.gzip.write(line);
+      this.gzip.flush();
+    } else {
+      this.file.write(line);
+    }
+    this.recorded++;
+  }
+
+  stats(): Record<string, number | string> {
+    return { mode: "record", recorded: this.recorded };
+  }
+}
+
+// 再生モード：記録した応答を記録時の間隔（× TIME_SCALE）で返す
+class TracePlayer {
+  private readonly exact = new Map<string, TraceEntry[]>();
+  private readonly byPath = new Map<string, TraceEntry[]>();
+  private readonly cursors = new Map<string, number>();
+  private exactHits = 0;
+  private pathHits = 0;
+  private misses = 0;
+
+  constructor(path: string) {
+    let data = fs.readFileSync(path);
+    if (path.endsWith(".gz")) {
+      // 記録中に終了したファイル（末尾のないgzip）も読めるようにする
+      data = zlib.gunzipSync(data, {
+        finishFlush: zlib.constants.Z_SYNC_FLUSH,
+      });
+    }
+    for (const line of data.toString("utf-8").split("\n")) {
+      if (!line) {
+        continue;
+      }
+      const entry = JSON.parse(line) as TraceEntry;
+      const exactKey = `${entry.method} ${entry.path} ${entry.hash}`;
+      const pathKey = `${entry.method} ${entry.path}`;
+      for (const [map, key] of [
+        [this.exact, exactKey],
+        [this.byPath, pathKey],
+      ] as const) {
+        const entries = map.get(key);
+        if (entries) {
+          entries.push(entry);
+        } else {
+          map.set(key, [entry]);
+        }
+      }
+    }
+  }
+
+  readonly fetch: FetchFunction = async (url, init) => {
+    const key = requestKey(url, init);
+    const exactKey = `${key.method} ${key.path} ${key.hash}`;
+    const pathKey = `${key.method} ${key.path}`;
+
+    let entry = this.next(exactKey, this.exact.get(exactKey));
+    if (entry) {
+      this.exactHits++;
+    } else {
+      entry = this.next(pathKey, this.byPath.get(pathKey));
+      if (entry) {
+        this.pathHits++;
+      }
+    }
+    if (!entry) {
+      this.misses++;
+      return new Response(
+        JSON.stringify({
+          error: { message: `記録されていないリクエスト: ${pathKey}` },
+        }),
+        { status: 404, headers: { "content-type": "application/json" } }
+      );
+    }
+
+    await pause(entry.ttfb);
+    const encoder = new TextEncoder();
+    const chunks = entry.chunks;
+    const ttfb = entry.ttfb;
+    let index = 0;
+    const body = new ReadableStream<Uint8Array>({
+      pull: async (controller) => {
+        if (index >= chunks.length) {
+          controller.close();
+          return;
+        }
+        const [at, text] = chunks[index];
+        const previous = index > 0 ? chunks[index - 1][0] : ttfb;
+        index++;
+        await pause(at - previous);
+        controller.enqueue(encoder.encode(text));
+      },
+    });
+    return new Response(body, {
+      status: entry.status,
+      headers: entry.type ? { "content-type": entry.type } : {},
+    });
+  };
+
+  // 同じキーの記録を順番に使い、最後まで使ったら先頭に戻る
+  private next(
+    key: string,
+    entries: TraceEntry[] | undefined
+  ): TraceEntry | undefined {
+    if (!entries || entries.length === 0) {
+      return undefined;
+    }
+    const cursor = this.cursors.get(key) || 0;
+    this.cursors.set(key, cursor + 1);
+    return entries[cursor % entries.length];
+  }
+
+  stats(): Record<string, number | string> {
+    return {
+      mode: "replay",
+      time_scale: TIME_SCALE,
+      exact_hits: this.exactHits,
+      path_hits: this.pathHits,
+      misses: this.misses,
+    };
+  }
+}
+
+const trace = REPLAY_PATH
+  ? new TracePlayer(REPLAY_PATH)
+  : RECORD_PATH
+    ? new TraceRecorder(RECORD_PATH)
+    : null;
+
+// 上流へのリクエストに使う fetch（記録・再生しない場合は undefined）
+export function traceFetch(): FetchFunction | undefined {
+  return trace?.fetch;
+}
+
+// 統計情報（記録・再生しない場合は null）
+export function traceStats(): Record<string, number | string> | null {
+  return trace ? trace.stats() : null;
+}
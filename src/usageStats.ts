@@ -0,0 +1,59 @@
+// 上流APIのトークン使用量とプロンプトキャッシュの集計
+//
+// completion.usage の prompt_tokens_details.cached_tokens は、前回までと
+// 先頭が一致したプロンプトのうち上流でキャッシュされていたトークン数。
+// 履歴の削り方によって先頭が変わるとキャッシュが効かなくなるため、
+// その割合を集計して削除方針の効果を測れるようにする。
+
+// completion.usage のうち集計に使う項目
+export interface UsageLike {
+  prompt_tokens?: number;
+  completion_tokens?: number;
+  prompt_tokens_details?: { cached_tokens?: number } | null;
+}
+
+export class UsageStats {
+  private requests = 0;
+  private promptTokens = 0;
+  private completionTokens = 0;
+  private cachedTokens = 0;
+  private cacheHits = 0; // キャッシュされたトークンがあったリクエスト数
+  private evictions = 0;
+  private evictedMessages = 0;
+
+  // 1リクエスト分の使用量を記録
+  record(usage: UsageLike | undefined): void {
+    if (!usage) {
+      return;
+    }
+    const cached = usage.prompt_tokens_details?.cached_tokens || 0;
+    this.requests++;
+    this.promptTokens += usage.prompt_tokens || 0;
+    this.completionTokens += usage.completion_tokens || 0;
+    this.cachedTokens += cached;
+    if (cached > 0) {
+      this.cacheHits++;
+    }
+  }
+
+  // 履歴の削除を記録
+  recordEviction(messages: number): void {
+    this.evictions++;
+    this.evictedMessages += messages;
+  }
+
+  // 統計情報
+  stats(): Record<string, number> {
+    const ratio = this.promptTokens ? this.cachedTokens / this.promptTokens : 0;
+    return {
+      requests: this.requests,
+      prompt_tokens: this.promptTokens,
+      completion_tokens: this.completionTokens,
+      cached_tokens: this.cachedTokens,
+      cached_ratio: Math.round(ratio * 1000) / 1000,
+      cache_hit_requests: this.cacheHits,
+      evictions: this.evictions,
+      evicted_messages: this.evictedMessages,
+    };
+  }
+}
@@ -0,0 +1,108 @@
+import { Worker } from "node:worker_threads";
+
+// ワーカーへ渡すタスク
+export interface WorkerTask {
+  type: string;
+  payload: unknown;
+}
+
+// ワーカーから返る結果
+export interface WorkerResult {
+  id: number;
+  buffer?: ArrayBuffer;
+  error?: string;
+}
+
+// 実行待ち・実行中のタスク
+interface PendingTask {
+  id: number;
+  task: WorkerTask;
+  resolve: (value: Uint8Array) => void;
+  reject: (reason: Error) => void;
+}
+
+// 固定サイズのワーカースレッドプール
+// 結果はArrayBufferの転送（コピーなし）で受け取る
+export class WorkerPool {
+  private readonly idle: Worker[] = [];
+  private readonly running = new Map<Worker, PendingTask>();
+  private readonly queue: PendingTask[] = [];
+  private workerCount = 0;
+  private nextId = 1;
+
+  constructor(
+    private readonly script: string,
+    private readonly size: number
+  ) {}
+
+  // タスクを実行し、結果のバイト列を返す
+  run(task: WorkerTask): Promise<Uint8Array> {
+    return new Promise((resolve, reject) => {
+      this.queue.push({ id: this.nextId++, task, resolve, reject });
+      this.dispatch();
+    });
+  }
+
+  // 待機中のタスク数
+  get pending(): number {
+    return this.queue.length;
+  }
+
+  // 空いているワーカーにタスクを割り当てる
+  private dispatch(): void {
+    while (this.queue.length > 0) {
+      const worker = this.idle.pop() || this.spawn();
+      if (!worker) {
+        return;
+      }
+      const pending = this.queue.shift() as PendingTask;
+      this.running.set(worker, pending);
+      worker.postMessage({ id: pending.id, ...pending.task });
+    }
+  }
+
+  // 上限に達していなければ新しいワーカーを起動
+  private spawn(): Worker | null {
+    if (this.workerCount >= this.size) {
+      return null;
+    }
+    const worker = new Worker(this.script);
+    // ワーカーの存在だけでプロセスが終了できなくならないようにする
+    worker.unref();
+    this.workerCount++;
+
+    worker.on("message", (result: WorkerResult) => {
+      const pending = this.running.get(worker);
+      this.running.delete(worker);
+      this.idle.push(worker);
+      if (pending) {
+        if (result.buffer) {
+          pending.resolve(new Uint8Array(result.buffer));
+        } else {
+          pending.reject(new Error(result.error || "ワーカーエラー"));
+        }
+      }
+      this.dispatch();
+    });
+
+    worker.on("error", (err) => {
+      const pending = this.running.get(worker);
+      this.running.delete(worker);
+      if (pending) {
+        pending.reject(err);
+      }
+    });
+
+    worker.on("exit", () => {
+      // 異常終了したワーカーはプールから外し、次のタスクで補充する
+      this.workerCount--;
+      const index = this.idle.indexOf(worker);
+      if (index >= 0) {
+        this.idle.splice(index, 1);
+      }
+      this.dispatch();
+    });
+
+    return worker;
+  }
+}
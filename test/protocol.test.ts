@@ -0,0 +1,30 @@
+import assert from "node:assert/strict";
+import { test } from "node:test";
+import { parseRequestLine } from "../src/protocol";
+
+// リクエスト行の解析のテスト
+
+test("既知の属性を取り出し、残りを本文とする", () => {
+  assert.deepEqual(
+    parseRequestLine("@key=5f3a @offset=1024 @meta=1 こんにちは"),
+    { attrs: { key: "5f3a", offset: "1024", meta: "1" }, body: "こんにちは" }
+  );
+});
+
+test("属性がなければ行全体が本文", () => {
+  assert.deepEqual(parseRequestLine("/models"), { attrs: {}, body: "/models" });
+});
+
+test("未知の属性は本文の一部として残す", () => {
+  assert.deepEqual(parseRequestLine("@todo=fix this later"), {
+    attrs: {},
+    body: "@todo=fix this later",
+  });
+});
+
+test("未知の属性が現れた時点で解析をやめる", () => {
+  assert.deepEqual(parseRequestLine("@key=abc @todo=fix @meta=1 あとで"), {
+    attrs: { key: "abc" },
+    body: "@todo=fix @meta=1 あとで",
+  });
+});
@@ -0,0 +1,422 @@
+import * as fs from "node:fs";
+import * as net from "node:net";
+import { parseHostPort } from "../src/replication";
+
+// 負荷再生ツール
+//
+// Cクライアントが CLIENT_TRACE_FILE に記録したトレース（要求の種類・サイズ・
+// 考慮時間・応答時間のみで、本文は含まない）から、操作の遷移（チャット、
+// /clear、/models、/model など）、考慮時間、プロンプトのサイズ、1セッションの
+// 要求数の分布を求め、それに従う多数の仮想ユーザーでサーバーに負荷をかける。
+// 種類ごとの応答時間とスループットを出力し、容量の見積もりに使う。
+//
+// 使い方: npm run load:replay -- trace.jsonl [trace2.jsonl ...]
+//   LOAD_TARGET        サーバー（既定: 127.0.0.1:3000）
+//   LOAD_USERS         仮想ユーザー数（既定: 1000）
+//   LOAD_DURATION_MS   測定時間（既定: 60000）
+//   LOAD_RAMP_MS       全ユーザーが開始するまでの時間（既定: 10000）
+//   LOAD_THINK_SCALE   考慮時間の倍率（0で待たずに送信、既定: 1）
+//   LOAD_TIMEOUT_MS    1要求の制限時間（既定: 120000）
+//   LOAD_REPORT_FILE   結果をJSONで書き出すファイル
+//
+// 上流なしで再現性のある測定をする場合は、サーバーを UPSTREAM_REPLAY
+// （記録した上流の通信の再生）または mock:upstream と組み合わせる。
+
+const TARGET = parseHostPort(process.env.LOAD_TARGET || "127.0.0.1:3000", 3000);
+const USERS = Number.parseInt(process.env.LOAD_USERS || "1000", 10);
+const DURATION_MS = Number.parseInt(
+  process.env.LOAD_DURATION_MS || "60000",
+  10
+);
+const RAMP_MS = Number.parseInt(process.env.LOAD_RAMP_MS || "10000", 10);
+const THINK_SCALE = Number.parseFloat(process.env.LOAD_THINK_SCALE || "1");
+const TIMEOUT_MS = Number.parseInt(process.env.LOAD_TIMEOUT_MS || "120000", 10);
+const REPORT_FILE = process.env.LOAD_REPORT_FILE || "";
+const PROGRESS_MS = 10000;
+
+const FRAME_END = "</response>\n";
+const FILLER =
+  "The quick brown fox jumps over the lazy dog while the server keeps up. ";
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// トレースの1行（Cクライアントの trace.c が出力する形式）
+interface TraceLine {
+  run: string;
+  seq: number;
+  kind: string;
+  think_ms: number;
+  prompt_bytes: number;
+  response_bytes: number;
+  latency_ms: number;
+  status: string;
+}
+
+// 1要求の結果
+interface Sample {
+  kind: string;
+  latencyMs: number;
+  bytes: number;
+  error: boolean;
+  ttftMs?: number;
+  serverMs?: number;
+}
+
+// 経験分布から1つ選ぶ
+function pick<T>(values: T[]): T {
+  return values[Math.floor(Math.random() * values.length)];
+}
+
+// パーセンタイル（昇順に並べた配列）
+function percentile(sorted: number[], p: number): number {
+  if (sorted.length === 0) {
+    return 0;
+  }
+  return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+}
+
+// トレースから求めた負荷モデル
+class Workload {
+  readonly thinkMs: number[] = [];
+  readonly promptBytes: number[] = [];
+  readonly sessionLengths: number[] = [];
+  readonly recordedLatency = new Map<string, number[]>();
+  // 直前の種類ごとの次の種類（"start" はセッションの最初）
+  private readonly transitions = new Map<string, string[]>();
+
+  constructor(lines: TraceLine[]) {
+    const runs = new Map<string, TraceLine[]>();
+    for (const line of lines) {
+      const run = runs.get(line.run);
+      if (run) {
+        run.push(line);
+      } else {
+        runs.set(line.run, [line]);
+      }
+    }
+
+    for (const run of runs.values()) {
+      run.sort((a, b) => a.seq - b.seq);
+      this.sessionLengths.push(run.length);
+      let previous = "start";
+      for (const line of run) {
+        const kind = line.kind === "other" ? "chat" : line.kind;
+        this.thinkMs.push(line.think_ms);
+        if (kind === "chat") {
+          this.promptBytes.push(Math.max(1, line.prompt_bytes));
+        }
+        if (line.status === "ok") {
+          const recorded = this.recordedLatency.get(kind) || [];
+          recorded.push(line.latency_ms);
+          this.recordedLatency.set(kind, recorded);
+        }
+        const next = this.transitions.get(previous) || [];
+        next.push(kind);
+        this.transitions.set(previous, next);
+        previous = kind;
+      }
+    }
+    if (this.promptBytes.length === 0) {
+      this.promptBytes.push(64);
+    }
+  }
+
+  // 直前の種類から次の種類を選ぶ（記録にない遷移は全体の分布から）
+  nextKind(previous: string): string {
+    const next = this.transitions.get(previous);
+    if (next && next.length > 0) {
+      return pick(next);
+    }
+    return pick(this.transitions.get("start") || ["chat"]);
+  }
+}
+
+// 1接続: 要求を送り、応答フレームの終端まで待つ
+class Connection {
+  private readonly socket: net.Socket;
+  private buffer = "";
+  private waiter: ((frame: string | null) => void) | null = null;
+  private closed = false;
+
+  private constructor(socket: net.Socket) {
+    this.socket = socket;
+    socket.setEncoding("utf-8");
+    socket.on("data", (chunk: string) => {
+      this.buffer += chunk;
+      const end = this.buffer.indexOf(FRAME_END);
+      if (end >= 0 && this.waiter) {
+        const frame = this.buffer.substring(0, end + FRAME_END.length);
+        this.buffer = this.buffer.substring(end + FRAME_END.length);
+        const waiter = this.waiter;
+        this.waiter = null;
+        waiter(frame);
+      }
+    });
+    const fail = () => {
+      this.closed = true;
+      if (this.waiter) {
+        const waiter = this.waiter;
+        this.waiter = null;
+        waiter(null);
+      }
+    };
+    socket.on("close", fail);
+    socket.on("error", fail);
+  }
+
+  static open(): Promise<Connection | null> {
+    return new Promise((resolve) => {
+      const socket = net.connect(TARGET.port, TARGET.host);
+      socket.once("connect", () => resolve(new Connection(socket)));
+      socket.once("error", () => resolve(null));
+    });
+  }
+
+  // 応答フレーム（切断・時間切れの場合は null）
+  request(line: string): Promise<string | null> {
+    if (this.closed) {
+      return Promise.resolve(null);
+    }
+    return new Promise((resolve) => {
+      const timer = setTimeout(() => {
+        this.waiter = null;
+        this.close();
+        resolve(null);
+      }, TIMEOUT_MS);
+      this.waiter = (frame) => {
+        clearTimeout(timer);
+        resolve(frame);
+      };
+      this.socket.write(`${line}\n`);
+    });
+  }
+
+  close(): void {
+    this.closed = true;
+    this.socket.destroy();
+  }
+}
+
+// 種類に応じた要求行
+function makeRequest(
+  kind: string,
+  workload: Workload,
+  models: string[],
+  user: number,
+  session: number
+): string {
+  switch (kind) {
+    case "clear":
+      return "/clear";
+    case "models":
+      return "/models";
+    case "model":
+      return models.length > 0 ? `/model ${pick(models)}` : "/models";
+    case "set":
+      return "/set";
+    case "stats":
+      return "/stats";
+    case "session":
+      return `/session load-${user}-${session}`;
+    case "batch":
+      return "/batch list";
+    default: {
+      const bytes = pick(workload.promptBytes);
+      const text = FILLER.repeat(Math.ceil(bytes / FILLER.length));
+      return `@meta=1 ${text.substring(0, bytes).trim() || "hello"}`;
+    }
+  }
+}
+
+// フレームから数値の要素を取り出す
+function frameNumber(frame: string, tag: string): number | undefined {
+  const match = new RegExp(`<${tag}>(\\d+)</${tag}>`).exec(frame);
+  return match ? Number.parseInt(match[1], 10) : undefined;
+}
+
+// 1ユーザー: 期限まで、セッション（接続）ごとに記録された分布に従って要求する
+async function runUser(
+  user: number,
+  workload: Workload,
+  models: string[],
+  deadline: number,
+  samples: Sample[],
+  active: { users: number }
+): Promise<void> {
+  let session = 0;
+  while (Date.now() < deadline) {
+    const connection = await Connection.open();
+    if (!connection) {
+      samples.push({ kind: "connect", latencyMs: 0, bytes: 0, error: true });
+      await sleep(1000);
+      continue;
+    }
+    active.users++;
+    const length = pick(workload.sessionLengths);
+    let previous = "start";
+    for (let i = 0; i < length; i++) {
+      await sleep(pick(workload.thinkMs) * THINK_SCALE);
+      if (Date.now() >= deadline) {
+        break;
+      }
+      const kind = workload.nextKind(previous);
+      previous = kind;
+      const startedAt = Date.now();
+      const frame = await connection.request(
+        makeRequest(kind, workload, models, user, session)
+      );
+      if (frame === null) {
+        samples.push({
+          kind,
+          latencyMs: Date.now() - startedAt,
+          bytes: 0,
+          error: true,
+        });
+        break;
+      }
+      samples.push({
+        kind,
+        latencyMs: Date.now() - startedAt,
+        bytes: Buffer.byteLength(frame),
+        error: frame.includes("<content>エラーが発生しました"),
+        ttftMs: frameNumber(frame, "ttft_ms"),
+        serverMs: frameNumber(frame, "total_ms"),
+      });
+    }
+    active.users--;
+    connection.close();
+    session++;
+  }
+}
+
+// 利用可能なモデル（/model の要求に使う）
+async function fetchModels(): Promise<string[]> {
+  const connection = await Connection.open();
+  if (!connection) {
+    throw new Error(`${TARGET.host}:${TARGET.port} に接続できません`);
+  }
+  const frame = (await connection.request("/models")) || "";
+  connection.close();
+  const list = /<available_models>([\s\S]*?)<\/available_models>/.exec(frame);
+  const models: string[] = [];
+  const pattern = /<model>\s*([^<]*?)\s*<\/model>/g;
+  let match = pattern.exec(list ? list[1] : "");
+  while (match) {
+    models.push(match[1]);
+    match = pattern.exec(list ? list[1] : "");
+  }
+  return models;
+}
+
+// 種類ごとの集計
+function summarize(samples: Sample[], workload: Workload, elapsedSec: number) {
+  const kinds = [...new Set(samples.map((sample) => sample.kind))].sort();
+  return kinds.map((kind) => {
+    const ofKind = samples.filter((sample) => sample.kind === kind);
+    const ok = ofKind.filter((sample) => !sample.error);
+    const latency = ok.map((sample) => sample.latencyMs).sort((a, b) => a - b);
+    const ttft = ok
+      .map((sample) => sample.ttftMs)
+      .filter((value): value is number => value !== undefined)
+      .sort((a, b) => a - b);
+    const recorded = (workload.recordedLatency.get(kind) || [])
+      .slice()
+      .sort((a, b) => a - b);
+    const bytes = ok.reduce((sum, sample) => sum + sample.bytes, 0);
+    return {
+      kind,
+      requests: ofKind.length,
+      errors: ofKind.length - ok.length,
+      "req/s": Math.round((ofKind.length / elapsedSec) * 10) / 10,
+      "p50 ms": percentile(latency, 0.5),
+      "p95 ms": percentile(latency, 0.95),
+      "p99 ms": percentile(latency, 0.99),
+      "max ms": latency.length ? latency[latency.length - 1] : 0,
+      "ttft p95": ttft.length ? percentile(ttft, 0.95) : "-",
+      "avg KB": ok.length ? Math.round(bytes / ok.length / 102.4) / 10 : 0,
+      "trace p50": recorded.length ? percentile(recorded, 0.5) : "-",
+    };
+  });
+}
+
+async function main(): Promise<void> {
+  const files = process.argv.slice(2);
+  if (files.length === 0) {
+    console.error("使い方: npm run load:replay -- trace.jsonl [...]");
+    process.exit(1);
+  }
+  const lines: TraceLine[] = [];
+  for (const file of files) {
+    for (const line of fs.readFileSync(file, "utf-8").split("\n")) {
+      if (line.trim()) {
+        lines.push(JSON.parse(line) as TraceLine);
+      }
+    }
+  }
+  const workload = new Workload(lines);
+  const models = await fetchModels();
+  console.log(
+    `トレース: ${lines.length}要求 / ${workload.sessionLengths.length}セッション` +
+      ` → ${USERS}ユーザー ${DURATION_MS}ms (考慮時間 x${THINK_SCALE})`
+  );
+
+  const samples: Sample[] = [];
+  const active = { users: 0 };
+  let peakUsers = 0;
+  const start = Date.now();
+  const deadline = start + DURATION_MS;
+
+  const progress = setInterval(() => {
+    const elapsed = (Date.now() - start) / 1000;
+    console.log(
+      `${Math.round(elapsed)}s: 接続中 ${active.users}ユーザー、` +
+        `${samples.length}要求 (${Math.round(samples.length / elapsed)} req/s)`
+    );
+  }, PROGRESS_MS);
+  const peak = setInterval(() => {
+    peakUsers = Math.max(peakUsers, active.users);
+  }, 100);
+
+  await Promise.all(
+    Array.from({ length: USERS }, async (_, user) => {
+      await sleep((RAMP_MS * user) / USERS);
+      await runUser(user, workload, models, deadline, samples, active);
+    })
+  );
+  clearInterval(progress);
+  clearInterval(peak);
+
+  const elapsedSec = (Date.now() - start) / 1000;
+  const table = summarize(samples, workload, elapsedSec);
+  const totalBytes = samples.reduce((sum, sample) => sum + sample.bytes, 0);
+  const server = samples
+    .map((sample) => sample.serverMs)
+    .filter((value): value is number => value !== undefined)
+    .sort((a, b) => a - b);
+  const summary = {
+    users: USERS,
+    peak_connected: peakUsers,
+    requests: samples.length,
+    errors: samples.filter((sample) => sample.error).length,
+    "req/s": Math.round((samples.length / elapsedSec) * 10) / 10,
+    "MB/s": Math.round((totalBytes / elapsedSec / 1048576) * 100) / 100,
+    "server p50 ms": percentile(server, 0.5),
+    "server p95 ms": percentile(server, 0.95),
+  };
+
+  console.log(
+    `target=${TARGET.host}:${TARGET.port} duration=${Math.round(elapsedSec)}s`
+  );
+  console.table([summary]);
+  console.table(table);
+  if (REPORT_FILE) {
+    fs.writeFileSync(
+      REPORT_FILE,
+      JSON.stringify({ summary, kinds: table }, null, 2)
+    );
+    console.log(`結果を書き出しました: ${REPORT_FILE}`);
+  }
+  process.exit(0);
+}
+
+main();
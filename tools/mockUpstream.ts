@@ -0,0 +1,398 @@
+import * as http from "node:http";
+
+// OpenAI互換の上流APIのダミーサーバー
+//
+// /v1/models と /v1/chat/completions（ストリーミングを含む）を実装し、
+// 最初のトークンまでの時間とトークンごとの間隔を指定して応答する。
+// BACKENDS_FILE でモデルをこのサーバーに向ければ、OpenAI や実際の推論サーバー
+// なしでバックエンドの振り分け・同時実行数・ヘルスチェックを確認できる。
+// バッチAPI（/v1/files、/v1/batches）も実装し、/batch の動作を確認できる。
+//
+// 使い方: npm run mock:upstream -- [port]（既定: 8001）
+//   MOCK_MODELS     提供するモデル（カンマ区切り、既定: mock-small,mock-large）
+//   MOCK_TTFT_MS    最初のトークンまでの時間（既定: 200）
+//   MOCK_TOKEN_MS   トークンごとの間隔（既定: 10）
+//   MOCK_TOKENS     応答のトークン数（既定: 50）
+//   MOCK_FAIL_RATE  500 を返す割合（0〜1、既定: 0。バッチでは件ごとの失敗）
+//   MOCK_BATCH_MS   バッチジョブが完了するまでの時間（既定: 3000）
+//
+// GET /mock/stats でリクエスト数と最大同時実行数を返す。
+
+const PORT = Number.parseInt(process.argv[2] || "8001", 10);
+const MODELS = (process.env.MOCK_MODELS || "mock-small,mock-large").split(",");
+const TTFT_MS = Number.parseInt(process.env.MOCK_TTFT_MS || "200", 10);
+const TOKEN_MS = Number.parseInt(process.env.MOCK_TOKEN_MS || "10", 10);
+const TOKENS = Number.parseInt(process.env.MOCK_TOKENS || "50", 10);
+const FAIL_RATE = Number.parseFloat(process.env.MOCK_FAIL_RATE || "0");
+const BATCH_MS = Number.parseInt(process.env.MOCK_BATCH_MS || "3000", 10);
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+const stats = {
+  requests: 0,
+  failed: 0,
+  in_flight: 0,
+  max_in_flight: 0,
+  batches: 0,
+};
+
+// アップロードされたファイルとバッチジョブ
+const files = new Map<string, { filename: string; content: string }>();
+const batches = new Map<string, Record<string, unknown>>();
+let nextId = 0;
+
+// リクエストボディの読み込み
+function readBody(req: http.IncomingMessage): Promise<Buffer> {
+  return new Promise((resolve, reject) => {
+    const chunks: Buffer[] = [];
+    req.on("data", (chunk: Buffer) => chunks.push(chunk));
+    req.on("end", () => resolve(Buffer.concat(chunks)));
+    req.on("error", reject);
+  });
+}
+
+function sendJson(
+  res: http.ServerResponse,
+  status: number,
+  body: unknown
+): void {
+  res.writeHead(status, { "Content-Type": "application/json" });
+  res.end(JSON.stringify(body));
+}
+
+// 応答のトークン（最後のユーザーメッセージの先頭を含める）
+function makeTokens(messages: { role: string; content: string }[]): string[] {
+  const last = [...messages].reverse().find((m) => m.role === "user");
+  const echo = last ? String(last.content).substring(0, 40) : "";
+  const tokens = [`[${echo}]`];
+  for (let i = 1; i < TOKENS; i++) {
+    tokens.push(` token${i}`);
+  }
+  return tokens;
+}
+
+// 応答本文と使用量
+function complete(request: {
+  messages?: { role: string; content: string }[];
+  max_completion_tokens?: number;
+  max_tokens?: number;
+}) {
+  const tokens = makeTokens(request.messages || []);
+  const promptTokens = Math.ceil(
+    Buffer.byteLength(JSON.stringify(request.messages)) / 4
+  );
+  const limit =
+    request.max_completion_tokens || request.max_tokens || tokens.length;
+  const output = tokens.slice(0, limit);
+  const usage = {
+    prompt_tokens: promptTokens,
+    completion_tokens: output.length,
+    total_tokens: promptTokens + output.length,
+    prompt_tokens_details: { cached_tokens: 0 },
+  };
+  return { output, usage };
+}
+
+async function chatCompletions(
+  req: http.IncomingMessage,
+  res: http.ServerResponse
+): Promise<void> {
+  const request = JSON.parse((await readBody(req)).toString("utf-8"));
+  if (!MODELS.includes(request.model)) {
+    sendJson(res, 404, {
+      error: {
+        message: `model '${request.model}' not found`,
+        type: "invalid_request_error",
+      },
+    });
+    return;
+  }
+  if (Math.random() < FAIL_RATE) {
+    stats.failed++;
+    sendJson(res, 500, {
+      error: { message: "mock failure", type: "server_error" },
+    });
+    return;
+  }
+
+  const id = `chatcmpl-mock-${stats.requests}`;
+  const created = Math.floor(Date.now() / 1000);
+  const { output, usage } = complete(request);
+
+  await sleep(TTFT_MS);
+
+  if (!request.stream) {
+    sendJson(res, 200, {
+      id,
+      object: "chat.completion",
+      created,
+      model: request.model,
+      choices: [
+        {
+          index: 0,
+          message: { role: "assistant", content: output.join("") },
+          finish_reason: "stop",
+        },
+      ],
+      usage,
+    });
+    return;
+  }
+
+  res.writeHead(200, {
+    "Content-Type": "text/event-stream",
+    "Cache-Control": "no-cache",
+  });
+  const send = (choices: unknown[], extra: Record<string, unknown> = {}) => {
+    res.write(
+      `data: ${JSON.stringify({
+        id,
+        object: "chat.completion.chunk",
+        created,
+        model: request.model,
+        choices,
+        ...extra,
+      })}\n\n`
+    );
+  };
+  for (let i = 0; i < output.length; i++) {
+    if (i > 0) {
+      await sleep(TOKEN_MS);
+    }
+    send([
+      {
+        index: 0,
+        delta:
+          i === 0
+            ? { role: "assistant", content: output[i] }
+            : { content: output[i] },
+        finish_reason: null,
+      },
+    ]);
+  }
+  send([{ index: 0, delta: {}, finish_reason: "stop" }]);
+  if (request.stream_options?.include_usage) {
+    send([], { usage });
+  }
+  res.end("data: [DONE]\n\n");
+}
+
+// ファイルのアップロード（multipart/form-data の file パートを取り出す）
+async function uploadFile(
+  req: http.IncomingMessage,
+  res: http.ServerResponse
+): Promise<void> {
+  const boundary = /boundary=(?:"([^"]+)"|([^;]+))/.exec(
+    req.headers["content-type"] || ""
+  );
+  if (!boundary) {
+    sendJson(res, 400, { error: { message: "multipart body required" } });
+    return;
+  }
+  const body = (await readBody(req)).toString("utf-8");
+  let filename = "upload.jsonl";
+  let content = "";
+  for (const part of body.split(`--${boundary[1] || boundary[2]}`)) {
+    const headerEnd = part.indexOf("\r\n\r\n");
+    if (headerEnd < 0 || !/name="file"/.test(part.substring(0, headerEnd))) {
+      continue;
+    }
+    filename = /filename="([^"]*)"/.exec(part)?.[1] || filename;
+    content = part.substring(headerEnd + 4).replace(/\r\n$/, "");
+  }
+  const id = `file-mock-${++nextId}`;
+  files.set(id, { filename, content });
+  sendJson(res, 200, fileObject(id));
+}
+
+function fileObject(id: string) {
+  const file = files.get(id);
+  return {
+    id,
+    object: "file",
+    bytes: file ? Buffer.byteLength(file.content) : 0,
+    created_at: Math.floor(Date.now() / 1000),
+    filename: file?.filename,
+    purpose: "batch",
+  };
+}
+
+// バッチジョブの作成（MOCK_BATCH_MS 後に全件を処理して完了する）
+async function createBatch(
+  req: http.IncomingMessage,
+  res: http.ServerResponse
+): Promise<void> {
+  const request = JSON.parse((await readBody(req)).toString("utf-8"));
+  const input = files.get(request.input_file_id);
+  if (!input) {
+    sendJson(res, 404, { error: { message: "input file not found" } });
+    return;
+  }
+  const lines = input.content.split("\n").filter((line) => line.trim());
+  const id = `batch-mock-${++nextId}`;
+  const batch: Record<string, unknown> = {
+    id,
+    object: "batch",
+    endpoint: request.endpoint,
+    input_file_id: request.input_file_id,
+    completion_window: request.completion_window,
+    status: "in_progress",
+    output_file_id: null,
+    error_file_id: null,
+    created_at: Math.floor(Date.now() / 1000),
+    request_counts: { total: lines.length, completed: 0, failed: 0 },
+    metadata: request.metadata || null,
+  };
+  batches.set(id, batch);
+  stats.batches++;
+
+  setTimeout(() => {
+    if (batch.status !== "in_progress") {
+      return;
+    }
+    const outputs: string[] = [];
+    const errors: string[] = [];
+    for (const line of lines) {
+      const item = JSON.parse(line);
+      const custom_id = item.custom_id;
+      if (!MODELS.includes(item.body?.model) || Math.random() < FAIL_RATE) {
+        errors.push(
+          JSON.stringify({
+            id: `req-${++nextId}`,
+            custom_id,
+            response: {
+              status_code: 500,
+              body: { error: { message: "mock failure" } },
+            },
+            error: null,
+          })
+        );
+        continue;
+      }
+      const { output, usage } = complete(item.body);
+      outputs.push(
+        JSON.stringify({
+          id: `req-${++nextId}`,
+          custom_id,
+          response: {
+            status_code: 200,
+            body: {
+              id: `chatcmpl-mock-${nextId}`,
+              object: "chat.completion",
+              model: item.body.model,
+              choices: [
+                {
+                  index: 0,
+                  message: { role: "assistant", content: output.join("") },
+                  finish_reason: "stop",
+                },
+              ],
+              usage,
+            },
+          },
+          error: null,
+        })
+      );
+    }
+    const save = (content: string[]) => {
+      if (content.length === 0) {
+        return null;
+      }
+      const fileId = `file-mock-${++nextId}`;
+      files.set(fileId, {
+        filename: `${id}.jsonl`,
+        content: `${content.join("\n")}\n`,
+      });
+      return fileId;
+    };
+    batch.output_file_id = save(outputs);
+    batch.error_file_id = save(errors);
+    batch.request_counts = {
+      total: lines.length,
+      completed: outputs.length,
+      failed: errors.length,
+    };
+    batch.status = "completed";
+  }, BATCH_MS);
+
+  sendJson(res, 200, batch);
+}
+
+const server = http.createServer(async (req, res) => {
+  const url = (req.url || "").replace(/^\/v1/, "");
+  try {
+    if (req.method === "GET" && url === "/models") {
+      sendJson(res, 200, {
+        object: "list",
+        data: MODELS.map((id) => ({
+          id,
+          object: "model",
+          created: 0,
+          owned_by: "mock",
+        })),
+      });
+      return;
+    }
+    if (req.method === "POST" && url === "/files") {
+      await uploadFile(req, res);
+      return;
+    }
+    const fileMatch = /^\/files\/([^/]+)(\/content)?$/.exec(url);
+    if (req.method === "GET" && fileMatch && files.has(fileMatch[1])) {
+      if (fileMatch[2]) {
+        res.writeHead(200, { "Content-Type": "application/octet-stream" });
+        res.end(files.get(fileMatch[1])?.content);
+      } else {
+        sendJson(res, 200, fileObject(fileMatch[1]));
+      }
+      return;
+    }
+    if (req.method === "POST" && url === "/batches") {
+      await createBatch(req, res);
+      return;
+    }
+    const batchMatch = /^\/batches\/([^/]+)(\/cancel)?$/.exec(url);
+    const batch = batchMatch ? batches.get(batchMatch[1]) : undefined;
+    if (batchMatch && batch) {
+      if (req.method === "POST" && batchMatch[2]) {
+        if (batch.status === "in_progress") {
+          batch.status = "cancelled";
+        }
+        sendJson(res, 200, batch);
+        return;
+      }
+      if (req.method === "GET" && !batchMatch[2]) {
+        sendJson(res, 200, batch);
+        return;
+      }
+    }
+    if (req.method === "GET" && url === "/mock/stats") {
+      sendJson(res, 200, stats);
+      return;
+    }
+    if (req.method === "POST" && url === "/chat/completions") {
+      stats.requests++;
+      stats.in_flight++;
+      stats.max_in_flight = Math.max(stats.max_in_flight, stats.in_flight);
+      try {
+        await chatCompletions(req, res);
+      } finally {
+        stats.in_flight--;
+      }
+      return;
+    }
+    sendJson(res, 404, {
+      error: { message: `${req.method} ${req.url} not found` },
+    });
+  } catch (error) {
+    sendJson(res, 400, {
+      error: { message: error instanceof Error ? error.message : String(error) },
+    });
+  }
+});
+
+server.listen(PORT, () => {
+  console.log(
+    `ダミー上流API: http://127.0.0.1:${PORT}/v1 (${MODELS.join(", ")})`
+  );
+});
@@ -0,0 +1,370 @@
+import { spawn } from "node:child_process";
+import * as fs from "node:fs";
+import * as net from "node:net";
+import * as path from "node:path";
+import { parseRequestLine } from "../src/protocol";
+import { parseHostPort } from "../src/replication";
+import { encodeXmlFrame } from "../src/serializer";
+
+// ネットワーク条件シミュレーター
+//
+// 用意した応答を、分割・遅延・帯域制限・停止・切断を加えて返すダミーサーバーを
+// 起動し、Cクライアントを実際に動かして応答ごとの完了時間と欠損率を測る。
+// シナリオは tools/scenarios/*.json に置く。
+//
+// 使い方:
+//   npm run netsim                        全シナリオを実行
+//   npm run netsim -- run stalls          名前を指定して実行
+//   npm run netsim -- proxy stalls 4001 127.0.0.1:3000
+//                                         実サーバーの前段に条件付きプロキシを置く
+//
+//   NETSIM_CLIENT  Cクライアントのパス（既定: c_client/bin/client）
+
+// シナリオ定義
+interface Scenario {
+  name: string;
+  description?: string;
+  requests: number; // 送信するメッセージ数
+  responseBytes: number; // 応答本文のおおよそのバイト数
+  text?: "ascii" | "japanese"; // 本文の文字種
+  segment?: { min: number; max: number }; // 1回の書き込みのバイト数
+  splitAtNewlines?: boolean; // 改行の直後で必ず区切る
+  delayMs?: { min: number; max: number }; // 書き込みごとの待ち時間
+  bandwidthBytesPerSec?: number; // 帯域制限
+  stalls?: { atByte: number; ms: number }[]; // 応答の指定位置で停止
+  disconnect?: { atByte: number; times: number }; // 指定位置で切断（最初のtimes回）
+  clientEnv?: Record<string, string>; // クライアントに渡す環境変数
+  timeoutMs?: number; // シナリオ全体の制限時間
+}
+
+// シナリオ結果
+interface ScenarioResult {
+  scenario: string;
+  requests: number;
+  completed: number;
+  truncated: number;
+  failed: number;
+  "p50 ms": number;
+  "p95 ms": number;
+  "max ms": number;
+  "total s": number;
+}
+
+const SCENARIO_DIR = path.join(__dirname, "scenarios");
+const CLIENT_PATH =
+  process.env.NETSIM_CLIENT ||
+  path.join(__dirname, "../c_client/bin/client");
+
+const TEXTS = {
+  ascii: "The quick brown fox jumps over the lazy dog.\n",
+  japanese: "吾輩は猫である。名前はまだ無い。どこで生れたかとんと見当がつかぬ。\n",
+};
+
+const sleep = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// 範囲内の乱数
+function randomBetween(range: { min: number; max: number }): number {
+  return range.min + Math.floor(Math.random() * (range.max - range.min + 1));
+}
+
+// シナリオファイルの読み込み
+function loadScenarios(names: string[]): Scenario[] {
+  const files = fs
+    .readdirSync(SCENARIO_DIR)
+    .filter((file) => file.endsWith(".json"))
+    .sort();
+  const scenarios = files.map(
+    (file) =>
+      JSON.parse(
+        fs.readFileSync(path.join(SCENARIO_DIR, file), "utf-8")
+      ) as Scenario
+  );
+  if (names.length === 0) {
+    return scenarios;
+  }
+  return scenarios.filter((scenario) => names.includes(scenario.name));
+}
+
+// 応答本文（リクエストごとに先頭を変えて取り違えを検出できるようにする）
+function makeContent(scenario: Scenario, index: number): string {
+  const text = TEXTS[scenario.text || "ascii"];
+  const header = `response ${index}\n`;
+  const count = Math.max(
+    1,
+    Math.ceil((scenario.responseBytes - header.length) / Buffer.byteLength(text))
+  );
+  return header + text.repeat(count);
+}
+
+// サーバーと同じ形式のXMLフレーム（サーバーと同じ encodeXmlFrame で生成）
+function makeFrame(fields: Record<string, string>): Buffer {
+  const bytes = encodeXmlFrame({ response: fields });
+  return Buffer.from(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+}
+
+// 条件を加えながらデータを書き込む
+// position は応答中のバイト位置（停止・切断の位置の判定に使う）
+class Shaper {
+  private chain: Promise<void> = Promise.resolve();
+  position = 0;
+
+  constructor(
+    private readonly socket: net.Socket,
+    private readonly scenario: Scenario,
+    private readonly attempt: number
+  ) {}
+
+  // 書き込みを順番に処理する
+  send(data: Buffer): Promise<void> {
+    this.chain = this.chain.then(() => this.write(data));
+    return this.chain;
+  }
+
+  private async write(data: Buffer): Promise<void> {
+    const { scenario, socket } = this;
+    let offset = 0;
+    while (offset < data.length && !socket.destroyed) {
+      let end = data.length;
+      if (scenario.segment) {
+        end = Math.min(end, offset + randomBetween(scenario.segment));
+      }
+      if (scenario.splitAtNewlines) {
+        const newline = data.indexOf(0x0a, offset);
+        if (newline >= 0 && newline + 1 < end) {
+          end = newline + 1;
+        }
+      }
+
+      // 切断位置をまたぐ場合は、そこまで書いて切断
+      const cut = scenario.disconnect;
+      if (cut && this.attempt <= cut.times) {
+        const at = cut.atByte - this.position;
+        if (at >= 0 && at < end - offset) {
+          socket.end(data.subarray(offset, offset + at));
+          return;
+        }
+      }
+
+      const chunk = data.subarray(offset, end);
+      const start = this.position;
+      offset = end;
+      this.position += chunk.length;
+      if (!socket.write(chunk)) {
+        await new Promise((resolve) => socket.once("drain", resolve));
+      }
+
+      // 停止位置をまたいだら停止
+      for (const stall of scenario.stalls || []) {
+        if (stall.atByte >= start && stall.atByte < this.position) {
+          await sleep(stall.ms);
+        }
+      }
+
+      let wait = scenario.delayMs ? randomBetween(scenario.delayMs) : 0;
+      if (scenario.bandwidthBytesPerSec) {
+        wait += (chunk.length / scenario.bandwidthBytesPerSec) * 1000;
+      }
+      if (wait > 0) {
+        await sleep(wait);
+      }
+    }
+  }
+}
+
+// シナリオを1つ実行
+async function runScenario(scenario: Scenario): Promise<ScenarioResult> {
+  const frames = new Map<string, Buffer>(); // 冪等キーごとの応答
+  const attempts = new Map<string, number>();
+  const arrivals: number[] = []; // 新しいメッセージの到着時刻
+  const expected: string[] = [];
+
+  const server = net.createServer((socket) => {
+    socket.setNoDelay(true);
+    let buffer = "";
+    socket.setEncoding("utf-8");
+    socket.on("data", (chunk: string) => {
+      buffer += chunk;
+      let index = buffer.indexOf("\n");
+      while (index >= 0) {
+        const line = buffer.substring(0, index);
+        buffer = buffer.substring(index + 1);
+        handleLine(socket, line);
+        index = buffer.indexOf("\n");
+      }
+    });
+    socket.on("error", () => socket.destroy());
+  });
+
+  const handleLine = (socket: net.Socket, line: string) => {
+    const { attrs, body } = parseRequestLine(line);
+    if (body.startsWith("/")) {
+      // コマンドには条件をかけずに応答
+      socket.write(
+        makeFrame({ type: "command", command: "session", message: "ok" })
+      );
+      return;
+    }
+
+    const key = attrs.key || `nokey-${arrivals.length}`;
+    let frame = frames.get(key);
+    if (!frame) {
+      const content = makeContent(scenario, arrivals.length);
+      expected.push(content.trim());
+      frame = makeFrame({ model: "netsim", content });
+      frames.set(key, frame);
+      arrivals.push(Date.now());
+    }
+    const attempt = (attempts.get(key) || 0) + 1;
+    attempts.set(key, attempt);
+
+    const offset = Math.min(
+      Number.parseInt(attrs.offset || "0", 10) || 0,
+      frame.length
+    );
+    const shaper = new Shaper(socket, scenario, attempt);
+    shaper.position = offset;
+    shaper.send(frame.subarray(offset));
+  };
+
+  await new Promise<void>((resolve) => server.listen(0, "127.0.0.1", resolve));
+  const port = (server.address() as net.AddressInfo).port;
+
+  // クライアントを起動し、全メッセージとexitを標準入力に流す
+  const start = Date.now();
+  const child = spawn(CLIENT_PATH, ["127.0.0.1", String(port)], {
+    env: { ...process.env, ...scenario.clientEnv },
+    stdio: ["pipe", "pipe", "pipe"],
+  });
+  let stdout = "";
+  let stderr = "";
+  child.stdout.setEncoding("utf-8");
+  child.stderr.setEncoding("utf-8");
+  child.stdout.on("data", (chunk: string) => {
+    stdout += chunk;
+  });
+  child.stderr.on("data", (chunk: string) => {
+    stderr += chunk;
+  });
+  for (let i = 0; i < scenario.requests; i++) {
+    child.stdin.write(`message ${i}\n`);
+  }
+  child.stdin.end("exit\n");
+
+  const timer = setTimeout(() => child.kill(), scenario.timeoutMs || 60000);
+  await new Promise((resolve) => child.once("close", resolve));
+  clearTimeout(timer);
+  const end = Date.now();
+  server.close();
+
+  if (process.env.NETSIM_VERBOSE) {
+    process.stderr.write(stderr);
+  }
+
+  // 表示された応答を期待値と比較（途中で解析された応答は生のまま表示される）
+  const pattern =
+    /=== (?:AI Response ===\n\[Model: [^\]\n]*\]|Server Response ===)\n([\s\S]*?)\n\nEnter your next message/g;
+  const shown: string[] = [];
+  for (let match = pattern.exec(stdout); match; match = pattern.exec(stdout)) {
+    shown.push(match[1]);
+  }
+  let completed = 0;
+  let truncated = 0;
+  for (let i = 0; i < expected.length; i++) {
+    if (shown[i] === expected[i]) {
+      completed++;
+    } else if (shown[i] !== undefined) {
+      truncated++;
+    }
+  }
+
+  // 応答の完了時間 = 次のメッセージ（最後はクライアント終了）までの時間
+  const latencies = arrivals
+    .map((arrival, i) => (arrivals[i + 1] ?? end) - arrival)
+    .sort((a, b) => a - b);
+  const percentile = (p: number) =>
+    latencies.length
+      ? latencies[Math.min(latencies.length - 1, Math.floor(latencies.length * p))]
+      : 0;
+
+  return {
+    scenario: scenario.name,
+    requests: scenario.requests,
+    completed,
+    truncated,
+    failed: scenario.requests - completed - truncated,
+    "p50 ms": percentile(0.5),
+    "p95 ms": percentile(0.95),
+    "max ms": latencies.length ? latencies[latencies.length - 1] : 0,
+    "total s": Math.round((end - start) / 100) / 10,
+  };
+}
+
+// 条件付きプロキシ（サーバーからクライアント方向にのみ条件をかける）
+function runProxy(scenario: Scenario, port: number, upstream: string): void {
+  const { host, port: upstreamPort } = parseHostPort(upstream, 3000);
+  let connections = 0;
+
+  net
+    .createServer((client) => {
+      connections++;
+      client.setNoDelay(true);
+      const server = net.connect(upstreamPort, host);
+      server.setNoDelay(true);
+      const shaper = new Shaper(client, scenario, connections);
+
+      // リクエスト行ごとに応答中の位置を数え直す
+      client.on("data", (data: Buffer) => {
+        if (data.includes(0x0a)) {
+          shaper.position = 0;
+        }
+        server.write(data);
+      });
+      server.on("data", (data: Buffer) => {
+        shaper.send(data);
+      });
+
+      const close = () => {
+        client.destroy();
+        server.destroy();
+      };
+      client.on("close", close);
+      server.on("close", close);
+      client.on("error", () => {});
+      server.on("error", () => {});
+    })
+    .listen(port, "127.0.0.1", () => {
+      console.log(
+        `netsim proxy (${scenario.name}): 127.0.0.1:${port} -> ${host}:${upstreamPort}`
+      );
+    });
+}
+
+async function main(): Promise<void> {
+  const [mode = "run", ...args] = process.argv.slice(2);
+
+  if (mode === "proxy") {
+    const [name, port, upstream] = args;
+    const [scenario] = loadScenarios([name]);
+    if (!scenario || !port || !upstream) {
+      console.error("usage: netsim proxy <scenario> <port> <host:port>");
+      process.exit(1);
+    }
+    runProxy(scenario, Number.parseInt(port, 10), upstream);
+    return;
+  }
+
+  if (!fs.existsSync(CLIENT_PATH)) {
+    console.error(`クライアントが見つかりません: ${CLIENT_PATH}（cd c_client && make）`);
+    process.exit(1);
+  }
+
+  const results: ScenarioResult[] = [];
+  for (const scenario of loadScenarios(args)) {
+    console.log(`${scenario.name}: ${scenario.description || ""}`);
+    results.push(await runScenario(scenario));
+  }
+  console.table(results);
+  process.exit(results.every((r) => r.completed === r.requests) ? 0 : 1);
+}
+
+main();